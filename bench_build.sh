@@ -0,0 +1,5 @@
+mkdir -p build/./src/ && \
+clang  -O2 -Wall -Wconversion -Wvla -Wextra -Wpedantic -march=native \
+-mavx2 -mfma -fno-strict-aliasing -c src/bench_main.c \
+-o build/./src/bench_main.c.o && \
+clang ./build/./src/bench_main.c.o -o build/bench_udc -lpthread
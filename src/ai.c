@@ -16,529 +16,955 @@
  */
 
 /*
- * Dependencies: game.h, util.c, hashmap.c
+ * Dependencies: game.h, util.c, memory.c, occupancy.c, fov.c, planner.c,
+ *		 scheduler.c, entity.c
  */
 
-#define MAX_ASTAR_NODES 128
+/*
+ * What an entity decided to do this turn. Filled in by a state's plan
+ * function, which may run on any worker thread, and applied by the state's
+ * commit function on the main thread.
+ */
+typedef struct AIIntent {
+	i32 entity; /* slot in the entity pool */
+	bool plan_only; /* only continuing a search, nothing to commit */
+	bool sees_player;
+	bool wants_move;
+	Vec2 move_target;
+	i32 path_next; /* the entity's PathCache next once it has moved */
+	i32 plan_budget; /* cell expansions the plan may spend */
+	i32 work; /* cells expanded or tiles tested while planning */
+} AIIntent;
+
+/*
+ * Occupancy as it will be after this turn's moves. Starts as a copy of the
+ * segment's occupancy and claims each tile as a move into it is committed.
+ */
+typedef struct ReservationTable {
+	u64 rows[SCREEN_HEIGHT_TILES];
+} ReservationTable;
+
+typedef struct AIContext {
+	EntityPool *entities;
+	WorldState *world_state;
+	MapSegment *map_segment;
+	Vec2 player_pos;
+	AIIntent *intents;
+	AIStateIndex *intent_states;
+} AIContext;
 
 typedef struct AIState {
-	i32 duration; /* in turns */
-	void (*do_action)(Entity *, WorldState *, PlayerState *);
+	i32 duration; /* in turns, at normal speed */
+	void (*plan)(AIContext *, AIIntent *);
+	void (*commit)(AIContext *, AIIntent *, ReservationTable *);
 	AIStateIndex next_state;
+	bool sleeps; /* only acts again once woken, see ai__wake */
 } AIState;
 
-static void ai_enemy_idle(Entity *, WorldState *world_state,
-			  PlayerState *player_state);
-static void ai_enemy_chase(Entity *entity, WorldState *world_state,
-			   PlayerState *player_state);
-
-static const AIState ai_states[] = {
-	{1, ai_enemy_idle, AIST_ENEMY_IDLE},  /* AIST_ENEMY_IDLE */
-	{1, ai_enemy_chase, AIST_ENEMY_CHASE} /* AIST_ENEMY_CHASE */
+static void ai_enemy_idle_plan(AIContext *context, AIIntent *intent);
+static void ai_enemy_idle_commit(AIContext *context, AIIntent *intent,
+				 ReservationTable *reservations);
+static void ai_enemy_chase_plan(AIContext *context, AIIntent *intent);
+static void ai_enemy_chase_commit(AIContext *context, AIIntent *intent,
+				  ReservationTable *reservations);
+
+static const AIState ai_states[AIST_COUNT] = {
+	/* AIST_ENEMY_IDLE */
+	{1, ai_enemy_idle_plan, ai_enemy_idle_commit, AIST_ENEMY_IDLE, true},
+	/* AIST_ENEMY_CHASE */
+	{1, ai_enemy_chase_plan, ai_enemy_chase_commit, AIST_ENEMY_CHASE,
+	 false},
 };
 
-void ai_run_ai_system(Entities *entities, WorldState *world_state,
-		      PlayerState *player_state)
+static void ai__plan_job(void *data, i32 index);
+static void ai__assign_planners(AIContext *context, i32 first_intent,
+				i32 num_intents);
+static i32 ai__schedule_searches(AIContext *context, i32 first_intent,
+				 i32 num_intents);
+static i32 ai__search_priority(AIContext *context, AIIntent *intent);
+static void ai__end_turn(WorldState *world_state, MapSegment *map_segment,
+			 i32 entity, u32 turn);
+static i32 ai__turn_delay(WorldState *world_state, i32 entity);
+static void ai__wake_watchers(AIContext *context);
+static void ai__wake(WorldState *world_state, MapSegment *map_segment,
+		     i32 entity);
+static void ai__invalidate_fovs(WorldState *world_state,
+				MapSegment *map_segment, Vec2 tile);
+static void ai__copy_path(PathBuffer *path, Planner *planner);
+static void ai__set_state(WorldState *world_state, SegmentEntities *list,
+			  i32 entity, AIStateIndex new_state);
+static void ai__release_path(WorldState *world_state, i32 entity);
+static bool ai__chase_goal(MapSegment *map_segment, Vec2 player_pos,
+			   Vec2 *goal);
+static void ai_update_entity_position(WorldState *world_state, i32 entity,
+				      MapSegment *map_segment,
+				      Vec2 new_position);
+
+/*
+ * Spawns an entity on a free tile of the segment, marking the tile as
+ * occupied. Returns the entity's slot, or -1 if the tile is taken or the
+ * pool is full.
+ */
+i32 ai_spawn_entity(WorldState *world_state, MapSegment *map_segment,
+		    Vec2 position, Direction face_direction,
+		    AIStateIndex ai_state)
+{
+	EntityPool *entities = &world_state->entities;
+	Vec2 *positions      = (Vec2 *)mem_rel_get(&entities->position);
+	Direction *facings =
+		(Direction *)mem_rel_get(&entities->face_direction);
+	i32 *speed         = (i32 *)mem_rel_get(&entities->speed);
+	u32 *next_turn     = (u32 *)mem_rel_get(&entities->next_turn);
+	PathCache *path_cache =
+		(PathCache *)mem_rel_get(&entities->path_cache);
+	FieldOfView *fov = (FieldOfView *)mem_rel_get(&entities->fov);
+
+	if (occ_is_opaque(map_segment, position.x, position.y))
+		return -1;
+
+	i32 entity = ent_alloc(entities, map_segment, ai_state);
+	if (entity < 0)
+		return -1;
+
+	positions[entity]  = position;
+	facings[entity]    = face_direction;
+	speed[entity]      = ENTITY_NORMAL_SPEED;
+	next_turn[entity]  = world_state->frame_clock;
+	path_cache[entity] = (PathCache){.planner = -1, .path = -1};
+	fov[entity].dirty  = true;
+
+	occ_set_entity(map_segment, position.x, position.y,
+		       ent_handle(entities, entity));
+	ai__invalidate_fovs(world_state, map_segment, position);
+	ai__wake(world_state, map_segment, entity);
+
+	return entity;
+}
+
+/*
+ * Moves the entities of a segment that's being evicted into the pool's
+ * store, under the segment's id, and frees their slots. Returns false,
+ * touching nothing, if the store hasn't room for them all.
+ */
+bool ai_store_segment(WorldState *world_state, MapSegment *map_segment)
 {
-	i32 num_entities = entities->num_entities;
-	Entity *ent_data = entities->data;
-	for (i32 i = 0; i < num_entities; i++) {
-		Entity *ent   = &ent_data[i];
-		AIState state = ai_states[ent->current_ai_state];
-
-		if (ent->ai_counter == 0) {
-			ent->current_ai_state = state.next_state;
-			ent->ai_counter =
-				state.duration * world_state->turn_duration - 1;
-			state.do_action(ent, world_state, player_state);
-		} else {
-			ent->ai_counter--;
+	EntityPool *entities  = &world_state->entities;
+	SegmentEntities *list = &map_segment->entities;
+	StoredEntity *stored =
+		(StoredEntity *)mem_rel_get(&entities->stored);
+	Vec2 *positions = (Vec2 *)mem_rel_get(&entities->position);
+	Direction *facings =
+		(Direction *)mem_rel_get(&entities->face_direction);
+	i32 *speed = (i32 *)mem_rel_get(&entities->speed);
+
+	if (list->num_entities > entities->capacity - entities->num_stored)
+		return false;
+
+	for (i32 state = 0; state < AIST_COUNT; state++) {
+		while (list->state_head[state] >= 0) {
+			i32 entity = list->state_head[state];
+
+			stored[entities->num_stored++] = (StoredEntity){
+				.segment_id     = map_segment->id,
+				.position       = positions[entity],
+				.face_direction = facings[entity],
+				.ai_state       = (AIStateIndex)state,
+				.speed          = speed[entity],
+			};
+
+			ai__release_path(world_state, entity);
+			ent_free(entities, map_segment, entity);
 		}
 	}
+
+	return true;
 }
 
-static void ai_enemy_idle(Entity *entity, WorldState *world_state,
-			  PlayerState *player_state)
+/*
+ * Spawns the stored entities of a segment that's just come in. Any the
+ * pool has no slot for stay stored until it next comes in.
+ */
+void ai_restore_segment(WorldState *world_state, MapSegment *map_segment)
 {
-	i32 segment_index        = world_state->current_map_segment->index;
-	IntHashMap *tile_props   = &world_state->tile_props;
-	Direction face_direction = entity->face_direction;
-
-	float player_pixel_x = (float)util_convert_tile_to_pixel(
-		player_state->tile_x, X_DIMENSION);
-	float player_pixel_y = (float)util_convert_tile_to_pixel(
-		player_state->tile_y, Y_DIMENSION);
-	float ent_pixel_x = (float)util_convert_tile_to_pixel(
-		entity->position.x, X_DIMENSION);
-	float ent_pixel_y = (float)util_convert_tile_to_pixel(
-		entity->position.y, Y_DIMENSION);
-
-	bool player_is_above = player_pixel_y < ent_pixel_y;
-	bool player_is_below = player_pixel_y > ent_pixel_y;
-	bool player_is_right = player_pixel_x > ent_pixel_x;
-	bool player_is_left  = player_pixel_x < ent_pixel_x;
-
-	switch (face_direction) {
-	case UPDIR: {
-		if (player_is_below)
-			return;
-		break;
-	}
-	case RIGHTDIR: {
-		if (player_is_left)
-			return;
-		break;
-	}
-	case DOWNDIR: {
-		if (player_is_above)
-			return;
-		break;
+	EntityPool *entities = &world_state->entities;
+	StoredEntity *stored =
+		(StoredEntity *)mem_rel_get(&entities->stored);
+	i32 *speed = (i32 *)mem_rel_get(&entities->speed);
+
+	for (i32 i = 0; i < entities->num_stored;) {
+		StoredEntity *record = &stored[i];
+		i32 entity           = -1;
+
+		if (record->segment_id == map_segment->id) {
+			entity = ai_spawn_entity(world_state, map_segment,
+						 record->position,
+						 record->face_direction,
+						 record->ai_state);
+		}
+
+		if (entity < 0) {
+			i++;
+			continue;
+		}
+
+		speed[entity] = record->speed;
+		*record       = stored[--entities->num_stored];
 	}
-	case LEFTDIR: {
-		if (player_is_right)
-			return;
-		break;
+}
+
+/*
+ * Runs full AI for one map segment. player_pos is in the segment's own tile
+ * coordinates, so for a segment next to the current one it lies off the edge.
+ *
+ * Runs in two phases. Planning works out what every due entity wants to do,
+ * reading occupancy but not changing it, so it's spread across the
+ * platform's worker threads. Committing then applies those decisions in
+ * state and list order on this thread, with a reservation table settling
+ * which of several entities gets a contested tile. Since planning only sees
+ * the occupancy from the start of the turn, the result doesn't depend on
+ * how many threads did the planning.
+ *
+ * Only entities due by world_state->frame_clock are touched, taken from the
+ * front of the segment's turn queue. Idle entities aren't queued between
+ * turns: they sleep until something in their view radius changes or the
+ * player steps into their field of view, see ai__wake.
+ */
+void ai_run_ai_system(MapSegment *map_segment, WorldState *world_state,
+		      Vec2 player_pos, Arena *scratch)
+{
+	EntityPool *entities   = &world_state->entities;
+	AIStateIndex *ai_state =
+		(AIStateIndex *)mem_rel_get(&entities->ai_state);
+	u32 *next_turn         = (u32 *)mem_rel_get(&entities->next_turn);
+	SegmentEntities *list  = &map_segment->entities;
+	ArenaMark mark         = mem_push_mark(scratch);
+
+	/* Entities never share a tile, so a segment can't hold more */
+	i32 *due = (i32 *)mem_arena_push(scratch, PLAN_NUM_CELLS * sizeof(i32),
+					 MEM_TAG_AI_SCRATCH);
+	AIIntent *intents = (AIIntent *)mem_arena_push(
+		scratch, PLAN_NUM_CELLS * sizeof(AIIntent), MEM_TAG_AI_SCRATCH);
+	AIStateIndex *intent_states = (AIStateIndex *)mem_arena_push(
+		scratch, PLAN_NUM_CELLS * sizeof(AIStateIndex),
+		MEM_TAG_AI_SCRATCH);
+	i32 num_due     = 0;
+	i32 num_intents = 0;
+
+	if (!due || !intents || !intent_states)
+		goto cleanup;
+
+	AIContext context = {
+		.entities      = entities,
+		.world_state   = world_state,
+		.map_segment   = map_segment,
+		.player_pos    = player_pos,
+		.intents       = intents,
+		.intent_states = intent_states,
+	};
+
+	if (player_pos.x != list->player_pos.x ||
+	    player_pos.y != list->player_pos.y) {
+		ai__wake_watchers(&context);
+		list->player_pos = player_pos;
 	}
-	default:
-		break;
+
+	i32 entity;
+	while ((entity = sched_pop_due(entities, &list->turns,
+				       world_state->frame_clock)) >= 0) {
+		due[num_due++] = entity;
 	}
 
-	bool player_visible = true;
-
-	/* Handle special cases where there's no angle between ent and player */
-	if (!player_is_above && !player_is_below) {
-		i32 ent_tile_x = entity->position.x;
-		i32 ent_tile_y = entity->position.y;
-		i32 loop_end   = player_is_right
-			? player_state->tile_x - ent_tile_x
-			: ent_tile_x - player_state->tile_x;
-
-		for (i32 i = 1; i < loop_end; i++) {
-			i32 test_tile_x = player_is_right ? ent_tile_x + i
-							  : ent_tile_x - i;
-
-			u32 key = util_compactify_three_u32((u32)segment_index,
-							    (u32)test_tile_x,
-							    (u32)ent_tile_y);
-			u64 props = hash_get_int(tile_props, key);
-			if (props & TPROP_HAS_COLLISION ||
-			    props & TPROP_ENTITY) {
-				player_visible = false;
-				break;
-			}
+	/*
+	 * Gather every due entity before running anything, so an entity that
+	 * changes state this frame doesn't act twice. Intents are grouped by
+	 * state, each group in the order its entities came due.
+	 */
+	for (i32 state_index = 0; state_index < AIST_COUNT; state_index++) {
+		i32 first = num_intents;
+
+		for (i32 i = 0; i < num_due; i++) {
+			if ((i32)ai_state[due[i]] != state_index)
+				continue;
+
+			intents[num_intents] = (AIIntent){.entity = due[i]};
+			intent_states[num_intents++] =
+				(AIStateIndex)state_index;
 		}
 
-		goto raycast_end;
+		if (state_index == AIST_ENEMY_CHASE) {
+			ai__assign_planners(&context, first,
+					    num_intents - first);
+			num_intents = ai__schedule_searches(
+				&context, first, num_intents - first);
+		}
 	}
 
-	if (!player_is_right && !player_is_left) {
-		i32 ent_tile_x = entity->position.x;
-		i32 ent_tile_y = entity->position.y;
-		i32 loop_end   = player_is_below
-			? player_state->tile_y - ent_tile_y
-			: ent_tile_y - player_state->tile_y;
-
-		for (i32 i = 1; i < loop_end; i++) {
-			i32 test_tile_y = player_is_below ? ent_tile_y + i
-							  : ent_tile_y - i;
-
-			u32 key = util_compactify_three_u32((u32)segment_index,
-							    (u32)ent_tile_x,
-							    (u32)test_tile_y);
-			u64 props = hash_get_int(tile_props, key);
-
-			if (props & TPROP_HAS_COLLISION ||
-			    props & TPROP_ENTITY) {
-				player_visible = false;
-				break;
-			}
+	if (!num_intents)
+		goto cleanup;
+
+	platform_parallel_for(ai__plan_job, &context, num_intents);
+
+	/* Hand back what searches didn't use to later segments this frame */
+	for (i32 i = 0; i < num_intents; i++) {
+		if (intents[i].plan_budget > 0) {
+			world_state->plan_budget +=
+				intents[i].plan_budget - intents[i].work;
 		}
+	}
 
-		goto raycast_end;
+	ReservationTable reservations;
+	Occupancy *occupancy = &context.map_segment->occupancy;
+	for (i32 y = 0; y < SCREEN_HEIGHT_TILES; y++) {
+		reservations.rows[y] =
+			occupancy->collision[y] | occupancy->entities[y];
 	}
 
-	/* Cast a ray between entity and player */
-	float opposite_length = player_pixel_y - ent_pixel_y;
-	float adjacent_length = player_pixel_x - ent_pixel_x;
-	float angle_tan       = -1.0f * (opposite_length / adjacent_length);
+	for (i32 i = 0; i < num_intents; i++) {
+		AIState state = ai_states[intent_states[i]];
+		i32 entity    = intents[i].entity;
+		if (intents[i].plan_only)
+			continue;
+
+		u32 turn = next_turn[entity];
+		ai__set_state(world_state, list, entity, state.next_state);
+		state.commit(&context, &intents[i], &reservations);
+		ai__end_turn(world_state, map_segment, entity, turn);
+	}
 
-	/* Check horizontal intersections */
-	i32 y_offset = player_is_above ? -TILE_HEIGHT : TILE_HEIGHT;
-	i32 x_offset = (i32)((float)TILE_HEIGHT / angle_tan);
+cleanup:
+	mem_pop_to_mark(scratch, mark);
+}
 
-	i32 test_point_y;
-	if (player_is_above) {
-		test_point_y =
-			(i32)(ent_pixel_y / (float)TILE_HEIGHT) * TILE_HEIGHT -
-			1;
+/*
+ * Queues the entity's next turn, one turn of its new state after the turn
+ * it just took, unless that state sleeps
+ */
+static void ai__end_turn(WorldState *world_state, MapSegment *map_segment,
+			 i32 entity, u32 turn)
+{
+	EntityPool *entities   = &world_state->entities;
+	AIStateIndex *ai_state =
+		(AIStateIndex *)mem_rel_get(&entities->ai_state);
+	AIState state          = ai_states[ai_state[entity]];
+	u32 next_turn = turn + (u32)ai__turn_delay(world_state, entity);
+
+	/* An entity that fell behind shouldn't act more than once a frame */
+	if ((i32)(next_turn - world_state->frame_clock) <= 0) {
+		next_turn = world_state->frame_clock + 1;
+	}
+
+	if (state.sleeps) {
+		((u32 *)mem_rel_get(&entities->next_turn))[entity] = next_turn;
 	} else {
-		x_offset *= -1;
-		test_point_y =
-			(i32)(ent_pixel_y / (float)TILE_HEIGHT) * TILE_HEIGHT +
-			TILE_HEIGHT;
+		sched_insert(entities, &map_segment->entities.turns, entity,
+			     next_turn);
 	}
+}
+
+/* Frames between the entity's turns in its current state */
+static i32 ai__turn_delay(WorldState *world_state, i32 entity)
+{
+	EntityPool *entities   = &world_state->entities;
+	AIStateIndex *ai_state =
+		(AIStateIndex *)mem_rel_get(&entities->ai_state);
+	i32 *speeds            = (i32 *)mem_rel_get(&entities->speed);
+	AIState state          = ai_states[ai_state[entity]];
+	i32 speed = speeds[entity] > 0 ? speeds[entity] : 1;
+	i32 delay = state.duration * world_state->turn_duration *
+		ENTITY_NORMAL_SPEED / speed;
+
+	return delay > 0 ? delay : 1;
+}
 
-	i32 test_point_x = (i32)(
-		ent_pixel_x + (ent_pixel_y - (float)test_point_y) / angle_tan);
+static void ai__plan_job(void *data, i32 index)
+{
+	AIContext *context = (AIContext *)data;
+	AIState state      = ai_states[context->intent_states[index]];
 
-	i32 test_tile_x = test_point_x / TILE_WIDTH;
-	i32 test_tile_y = test_point_y / TILE_HEIGHT;
+	state.plan(context, &context->intents[index]);
+}
 
-	bool should_loop = true;
-	while (should_loop) {
-		u32 key = util_compactify_three_u32(
-			(u32)segment_index, (u32)test_tile_x, (u32)test_tile_y);
-		u64 props = hash_get_int(tile_props, key);
-		if (props & TPROP_HAS_COLLISION || props & TPROP_ENTITY) {
-			player_visible = false;
-			break;
-		}
+/*
+ * Planners come from a shared pool, so hand them out here, before planning
+ * runs in parallel. A planner already handed out this turn is never taken
+ * again. Chasers without a planner pick first, in slot order, so once
+ * there are more chasers than planners the least recently used ones go
+ * round instead of staying with the same few. A chaser left without one
+ * keeps walking its last path and starts its search over when it gets one
+ * back; bench_udc chasers measures what that costs. Chasers that get a
+ * planner also get a path buffer, kept until they stop chasing or leave
+ * full detail. If the buffers have run out, the planner goes back.
+ */
+static void ai__assign_planners(AIContext *context, i32 first_intent,
+				i32 num_intents)
+{
+	WorldState *world_state = context->world_state;
+	EntityPool *entities    = context->entities;
+	Planner *planners = (Planner *)mem_rel_get(&world_state->planners);
+	PathCache *path_caches =
+		(PathCache *)mem_rel_get(&entities->path_cache);
+	u32 turn_start = world_state->planner_clock + 1;
+
+	for (i32 pass = 0; pass < 2; pass++) {
+		for (i32 i = first_intent; i < first_intent + num_intents;
+		     i++) {
+			i32 entity            = context->intents[i].entity;
+			EntityHandle handle   = ent_handle(entities, entity);
+			PathCache *path_cache = &path_caches[entity];
+			bool has_planner      = path_cache->planner >= 0 &&
+				planners[path_cache->planner].owner == handle;
+
+			if (has_planner != (pass == 1))
+				continue;
 
-		test_point_x += x_offset;
-		test_point_y += y_offset;
-		test_tile_x = test_point_x / TILE_WIDTH;
-		test_tile_y = test_point_y / TILE_HEIGHT;
+			path_cache->planner = plan_acquire(
+				planners, world_state->num_planners, handle,
+				++world_state->planner_clock, turn_start);
 
-		switch (face_direction) {
-		case UPDIR: {
-			should_loop = test_tile_y > player_state->tile_y;
-			break;
-		}
-		case RIGHTDIR: {
-			should_loop = test_tile_x < player_state->tile_x;
-			break;
-		}
-		case DOWNDIR: {
-			should_loop = test_tile_y < player_state->tile_y;
-			break;
-		}
-		case LEFTDIR: {
-			should_loop = test_tile_x > player_state->tile_x;
-			break;
-		}
-		default:
-			should_loop = false;
-			break;
+			/* A search with nowhere to put its path is wasted */
+			if (path_cache->planner >= 0 &&
+			    !ent_alloc_path(entities, entity)) {
+				plan_release(planners,
+					     world_state->num_planners, handle);
+				path_cache->planner = -1;
+			}
 		}
 	}
+}
 
-	if (!player_visible)
-		goto raycast_end;
+/*
+ * Chase searches share a budget of cell expansions per frame, handed out a
+ * slice at a time to the chasers closest to the player first, so frame time
+ * stays flat however many entities start chasing at once. A search that
+ * runs out picks up where it left off on later frames: chasers holding an
+ * unfinished search that aren't due this frame are added as plan-only
+ * intents. Until a search finishes, its chaser keeps walking its last path.
+ *
+ * Chase intents are sorted by priority, which is also the order their moves
+ * are committed in. Returns the new total number of intents.
+ */
+static i32 ai__schedule_searches(AIContext *context, i32 first_intent,
+				 i32 num_intents)
+{
+	WorldState *world_state = context->world_state;
+	EntityPool *entities    = context->entities;
+	Planner *planners = (Planner *)mem_rel_get(&world_state->planners);
+	Vec2 *positions   = (Vec2 *)mem_rel_get(&entities->position);
+	i32 *list_next    = (i32 *)mem_rel_get(&entities->list_next);
+	PathCache *path_caches =
+		(PathCache *)mem_rel_get(&entities->path_cache);
+	SegmentEntities *list = &context->map_segment->entities;
+	AIIntent *intents     = context->intents;
+	i32 end               = first_intent + num_intents;
+
+	/* Entities never share a tile, so mark due chasers by position */
+	u64 is_due[SCREEN_HEIGHT_TILES] = {0};
+	for (i32 i = first_intent; i < end; i++) {
+		Vec2 position = positions[intents[i].entity];
+		is_due[position.y] |= (u64)1 << position.x;
+	}
 
-	/* Check vertical intersections */
-	x_offset = player_is_right ? TILE_WIDTH : -TILE_WIDTH;
-	y_offset = (i32)((float)TILE_HEIGHT * angle_tan);
+	for (i32 entity = list->state_head[AIST_ENEMY_CHASE];
+	     entity >= 0 && end < PLAN_NUM_CELLS;
+	     entity = list_next[entity]) {
+		Vec2 position = positions[entity];
+		i32 planner   = path_caches[entity].planner;
 
-	if (player_is_right) {
-		y_offset *= -1;
-		test_point_x =
-			(i32)(ent_pixel_x / (float)TILE_WIDTH) * TILE_WIDTH +
-			TILE_HEIGHT;
-	} else {
-		test_point_x =
-			(i32)(ent_pixel_x / (float)TILE_WIDTH) * TILE_WIDTH - 1;
-	}
+		if (is_due[position.y] & ((u64)1 << position.x) || planner < 0)
+			continue;
+
+		if (planners[planner].owner != ent_handle(entities, entity) ||
+		    planners[planner].search_done)
+			continue;
 
-	test_point_y = (i32)(ent_pixel_y +
-			     (ent_pixel_x - (float)test_point_x) * angle_tan);
+		intents[end] = (AIIntent){.entity = entity, .plan_only = true};
+		context->intent_states[end++] = AIST_ENEMY_CHASE;
+	}
 
-	test_tile_x = test_point_x / TILE_WIDTH;
-	test_tile_y = test_point_y / TILE_HEIGHT;
+	/* Insertion sort, stable so ties stay in list order */
+	for (i32 i = first_intent + 1; i < end; i++) {
+		AIIntent intent = intents[i];
+		i32 priority    = ai__search_priority(context, &intent);
+		i32 j           = i - 1;
 
-	should_loop = true;
-	while (should_loop) {
-		u32 key = util_compactify_three_u32(
-			(u32)segment_index, (u32)test_tile_x, (u32)test_tile_y);
-		u64 props = hash_get_int(tile_props, key);
-		if (props & TPROP_HAS_COLLISION || props & TPROP_ENTITY) {
-			player_visible = false;
-			break;
+		while (j >= first_intent &&
+		       ai__search_priority(context, &intents[j]) > priority) {
+			intents[j + 1] = intents[j];
+			j--;
 		}
 
-		test_point_x += x_offset;
-		test_point_y += y_offset;
-		test_tile_x = test_point_x / TILE_WIDTH;
-		test_tile_y = test_point_y / TILE_HEIGHT;
+		intents[j + 1] = intent;
+	}
 
-		switch (face_direction) {
-		case UPDIR: {
-			should_loop = test_tile_y > player_state->tile_y;
-			break;
-		}
-		case RIGHTDIR: {
-			should_loop = test_tile_x < player_state->tile_x;
-			break;
-		}
-		case DOWNDIR: {
-			should_loop = test_tile_y < player_state->tile_y;
-			break;
-		}
-		case LEFTDIR: {
-			should_loop = test_tile_x > player_state->tile_x;
-			break;
-		}
-		default:
-			should_loop = false;
-			break;
-		}
+	for (i32 i = first_intent; i < end; i++) {
+		i32 slice = util_clamp(world_state->plan_budget, 0,
+				       PLAN_EXPANSIONS_PER_SLICE);
+
+		intents[i].plan_budget = slice;
+		world_state->plan_budget -= slice;
 	}
 
-raycast_end:
-	if (player_visible) {
-		printf("%s\n", "player visible!");
-		if (player_is_below && face_direction != DOWNDIR) {
-			entity->face_direction = DOWNDIR;
-		} else if (player_is_above && face_direction != UPDIR) {
-			entity->face_direction = UPDIR;
+	return end;
+}
+
+/* Lower goes first */
+static i32 ai__search_priority(AIContext *context, AIIntent *intent)
+{
+	Vec2 *positions = (Vec2 *)mem_rel_get(&context->entities->position);
+	Vec2 position   = positions[intent->entity];
+
+	return util_abs(position.x - context->player_pos.x) +
+		util_abs(position.y - context->player_pos.y);
+}
+
+/*
+ * The player has moved. Each idle entity's field of view is the region it
+ * watches, so wake those whose view takes in the player's new tile. Only
+ * entities within view radius of it can, and occupancy finds those without
+ * walking the idle list.
+ */
+static void ai__wake_watchers(AIContext *context)
+{
+	EntityPool *entities    = context->entities;
+	MapSegment *map_segment = context->map_segment;
+	Vec2 player_pos         = context->player_pos;
+	AIStateIndex *ai_state =
+		(AIStateIndex *)mem_rel_get(&entities->ai_state);
+	FieldOfView *fovs      = (FieldOfView *)mem_rel_get(&entities->fov);
+
+	/* From a neighbouring segment the player can't be seen */
+	if (player_pos.x < 0 || player_pos.x >= SCREEN_WIDTH_TILES ||
+	    player_pos.y < 0 || player_pos.y >= SCREEN_HEIGHT_TILES)
+		return;
+
+	EntityHandle nearby[OCC_QUERY_BATCH];
+	i32 cursor = 0;
+
+	while (cursor < OCC_NUM_TILES) {
+		i32 num_nearby = occ_entities_in_radius(
+			map_segment, player_pos, FOV_RADIUS, &cursor, nearby,
+			OCC_QUERY_BATCH);
+
+		for (i32 i = 0; i < num_nearby; i++) {
+			i32 entity = ent_slot(entities, nearby[i]);
+			if (entity < 0 || ai_state[entity] != AIST_ENEMY_IDLE)
+				continue;
+
+			FieldOfView *fov = &fovs[entity];
+			if (fov->dirty ||
+			    fov_is_visible(fov, player_pos.x, player_pos.y)) {
+				ai__wake(context->world_state, map_segment,
+					 entity);
+			}
 		}
+	}
+}
+
+/*
+ * Queues a sleeping entity for its next turn. It slept through the turns it
+ * missed, so that's the first one still to come, keeping it in step with
+ * where its turns would have fallen. Low-detail segments don't queue
+ * anyone.
+ */
+static void ai__wake(WorldState *world_state, MapSegment *map_segment,
+		     i32 entity)
+{
+	EntityPool *entities = &world_state->entities;
+	i32 *turn_index      = (i32 *)mem_rel_get(&entities->turn_index);
+	u32 frame_clock      = world_state->frame_clock;
+	u32 next_turn = ((u32 *)mem_rel_get(&entities->next_turn))[entity];
 
-		entity->current_ai_state = AIST_ENEMY_CHASE;
+	if (!world_state->is_full_detail[map_segment->index] ||
+	    turn_index[entity] >= 0)
+		return;
+
+	if ((i32)(frame_clock - next_turn) > 0) {
+		u32 delay  = (u32)ai__turn_delay(world_state, entity);
+		u32 missed = (frame_clock - next_turn + delay - 1) / delay;
+		next_turn += missed * delay;
+	}
+
+	sched_insert(entities, &map_segment->entities.turns, entity,
+		     next_turn);
+}
+
+/*
+ * Idle entities whose view radius covers the tile must recompute their FOV,
+ * so wake them
+ */
+static void ai__invalidate_fovs(WorldState *world_state,
+				MapSegment *map_segment, Vec2 tile)
+{
+	EntityPool *entities   = &world_state->entities;
+	AIStateIndex *ai_state =
+		(AIStateIndex *)mem_rel_get(&entities->ai_state);
+	FieldOfView *fov       = (FieldOfView *)mem_rel_get(&entities->fov);
+	EntityHandle nearby[OCC_QUERY_BATCH];
+	i32 cursor = 0;
+
+	while (cursor < OCC_NUM_TILES) {
+		i32 num_nearby = occ_entities_in_radius(
+			map_segment, tile, FOV_RADIUS, &cursor, nearby,
+			OCC_QUERY_BATCH);
+
+		for (i32 i = 0; i < num_nearby; i++) {
+			i32 entity = ent_slot(entities, nearby[i]);
+			if (entity < 0)
+				continue;
+
+			if (ai_state[entity] == AIST_ENEMY_IDLE) {
+				fov[entity].dirty = true;
+				ai__wake(world_state, map_segment, entity);
+			}
+		}
 	}
 }
 
-static i32 astar_compute_fcost(AStarNode node)
+static void ai__copy_path(PathBuffer *path, Planner *planner)
 {
-	return node.g_cost + node.h_cost;
+	path->length = planner->path_length;
+
+	memcpy(path->cells, planner->path,
+	       (size_t)path->length * sizeof(*path->cells));
 }
 
-static i32 astar_compute_distance(Vec2 pos1, Vec2 pos2)
+/*
+ * Moves the entity to the list for new_state. Leaving the chase hands its
+ * planner and path buffer back, since only chasers use them.
+ */
+static void ai__set_state(WorldState *world_state, SegmentEntities *list,
+			  i32 entity, AIStateIndex new_state)
 {
-	i32 x = util_abs(pos1.x - pos2.x);
-	i32 y = util_abs(pos1.y - pos2.y);
+	EntityPool *entities = &world_state->entities;
+	AIStateIndex *ai_state =
+		(AIStateIndex *)mem_rel_get(&entities->ai_state);
 
-	i32 out = x >= y ? 14 * y + 10 * (x - y) : 14 * x + 10 * (y - x);
+	if (ai_state[entity] == AIST_ENEMY_CHASE &&
+	    new_state != AIST_ENEMY_CHASE) {
+		ai__release_path(world_state, entity);
+	}
 
-	return out;
+	ent_set_state(entities, list, entity, new_state);
 }
 
-static i32 astar_delete_open_node(AStarNode open_nodes[MAX_ASTAR_NODES],
-				  i32 node_index, i32 open_nodes_length)
+static void ai__release_path(WorldState *world_state, i32 entity)
 {
-	if (open_nodes_length == 0)
-		return 0;
-	i32 last_index         = open_nodes_length - 1;
-	AStarNode temp         = open_nodes[last_index];
-	open_nodes[last_index] = open_nodes[node_index];
-	open_nodes[node_index] = temp;
-
-	return last_index;
+	EntityPool *entities = &world_state->entities;
+	Planner *planners = (Planner *)mem_rel_get(&world_state->planners);
+	PathCache *path_cache =
+		&((PathCache *)mem_rel_get(&entities->path_cache))[entity];
+
+	plan_release(planners, world_state->num_planners,
+		     ent_handle(entities, entity));
+	ent_free_path(entities, entity);
+	path_cache->planner = -1;
 }
 
-static i32 astar_find_open_node(AStarNode open_nodes[MAX_ASTAR_NODES],
-				Vec2 position, i32 open_nodes_length)
+/*
+ * Where a chaser in this segment should head. That's the player if they're
+ * in it. Otherwise it's the open tile on the edge facing them that's
+ * nearest to them, so chasers path to a real crossing instead of into a
+ * wall. Returns false if that edge is walled off.
+ */
+static bool ai__chase_goal(MapSegment *map_segment, Vec2 player_pos,
+			   Vec2 *goal)
 {
-	i32 index = -1;
-	for (int i = 0; i < open_nodes_length; i++) {
-		AStarNode node = open_nodes[i];
+	u64 *collision = map_segment->occupancy.collision;
+	Vec2 edge      = {
+		.x = util_clamp(player_pos.x, 0, SCREEN_WIDTH_TILES - 1),
+		.y = util_clamp(player_pos.y, 0, SCREEN_HEIGHT_TILES - 1),
+	};
+
+	if (edge.x == player_pos.x && edge.y == player_pos.y) {
+		*goal = player_pos;
+		return true;
+	}
 
-		if (node.position.x == position.x &&
-		    node.position.y == position.y) {
-			index = i;
-			break;
+	/* Off the top or bottom the edge is a row, otherwise a column */
+	bool is_row = edge.y != player_pos.y;
+	i32 length  = is_row ? SCREEN_WIDTH_TILES : SCREEN_HEIGHT_TILES;
+	i32 along   = is_row ? edge.x : edge.y;
+	i32 best    = -1;
+
+	for (i32 i = 0; i < length; i++) {
+		Vec2 cell = is_row ? (Vec2){.x = i, .y = edge.y} :
+				     (Vec2){.x = edge.x, .y = i};
+
+		if (collision[cell.y] & ((u64)1 << cell.x))
+			continue;
+
+		if (best < 0 || util_abs(i - along) < best) {
+			best  = util_abs(i - along);
+			*goal = cell;
 		}
 	}
 
-	return index;
+	return best >= 0;
 }
 
-static void ai_update_entity_position(Entity *entity, WorldState *world_state)
+static void ai_update_entity_position(WorldState *world_state, i32 entity,
+				      MapSegment *map_segment,
+				      Vec2 new_position)
 {
-	u32 map_segment = (u32)world_state->current_map_segment->index;
-	u32 x           = (u32)entity->position.x;
-	u32 y           = (u32)entity->position.y;
-	IntHashMap *map = &world_state->tile_props;
+	EntityPool *entities = &world_state->entities;
+	Vec2 *positions      = (Vec2 *)mem_rel_get(&entities->position);
+	Vec2 old_position    = positions[entity];
+
+	occ_clear_entity(map_segment, old_position.x, old_position.y);
+
+	positions[entity] = new_position;
+	occ_set_entity(map_segment, new_position.x, new_position.y,
+		       ent_handle(entities, entity));
+	ai__invalidate_fovs(world_state, map_segment, old_position);
+	ai__invalidate_fovs(world_state, map_segment, new_position);
+}
 
-	/* Remove ent data from old position tile props */
-	u32 key            = util_compactify_three_u32(map_segment, x, y);
-	u64 original_props = hash_get_int(map, key);
-	u64 new_props      = original_props & ~((u32)TPROP_ENTITY);
+/*
+ * Refreshes the entity's field of view and tests it against the player. A
+ * FOV is only recomputed when the entity has moved or turned, or a tile
+ * within its radius changed occupancy.
+ */
+static void ai_enemy_idle_plan(AIContext *context, AIIntent *intent)
+{
+	EntityPool *entities = context->entities;
+	i32 entity           = intent->entity;
+	Vec2 position = ((Vec2 *)mem_rel_get(&entities->position))[entity];
+	Direction facing =
+		((Direction *)mem_rel_get(&entities->face_direction))[entity];
+	FieldOfView *fov =
+		&((FieldOfView *)mem_rel_get(&entities->fov))[entity];
+
+	if (fov->dirty || fov->origin.x != position.x ||
+	    fov->origin.y != position.y || fov->facing != facing) {
+		intent->work = fov_compute(fov, context->map_segment,
+					   position, facing);
+	}
 
-	(void)hash_insert_int(map, key, new_props);
+	intent->sees_player = fov_is_visible(fov, context->player_pos.x,
+					     context->player_pos.y);
+}
 
-	i32 index        = MAX_PATH_LENGTH - entity->path_counter;
-	entity->position = entity->path_cache.data[index];
+static void ai_enemy_idle_commit(AIContext *context, AIIntent *intent,
+				 ReservationTable *reservations)
+{
+	(void)reservations;
 
-	/* Add ent to new position tile props */
-	x = (u32)entity->position.x;
-	y = (u32)entity->position.y;
+	if (!intent->sees_player)
+		return;
 
-	key            = util_compactify_three_u32(map_segment, x, y);
-	original_props = hash_get_int(map, key);
-	new_props = original_props | ((u64)entity->id << TPROP_ENTITY_SHIFT);
+	EntityPool *entities = context->entities;
+	i32 entity           = intent->entity;
+	Vec2 position = ((Vec2 *)mem_rel_get(&entities->position))[entity];
+	Direction *face_direction =
+		(Direction *)mem_rel_get(&entities->face_direction);
+
+	printf("%s\n", "player visible!");
+	if (context->player_pos.y > position.y) {
+		face_direction[entity] = DOWNDIR;
+	} else if (context->player_pos.y < position.y) {
+		face_direction[entity] = UPDIR;
+	}
 
-	(void)hash_insert_int(map, key, new_props);
+	ai__set_state(context->world_state, &context->map_segment->entities,
+		      entity, AIST_ENEMY_CHASE);
 }
 
-static void ai_enemy_chase(Entity *entity, WorldState *world_state,
-			   PlayerState *player_state)
+/*
+ * Spends the intent's share of the search budget repairing the entity's
+ * planner against the current player position and occupancy, then picks the
+ * next step: the start of the new path if the search finished, otherwise
+ * the next step along the last one. A chaser whose planner was taken keeps
+ * following its last path.
+ */
+static void ai_enemy_chase_plan(AIContext *context, AIIntent *intent)
 {
-	if (entity->path_counter) {
-		i32 index = MAX_PATH_LENGTH - entity->path_counter;
-		if (index < entity->path_cache.length) {
-			ai_update_entity_position(entity, world_state);
-		}
-		entity->path_counter--;
+	EntityPool *entities  = context->entities;
+	i32 entity            = intent->entity;
+	PathCache *path_cache =
+		&((PathCache *)mem_rel_get(&entities->path_cache))[entity];
+	Vec2 position   = ((Vec2 *)mem_rel_get(&entities->position))[entity];
+	Vec2 goal;
+
+	if (!ai__chase_goal(context->map_segment, context->player_pos, &goal))
 		return;
-	}
-	Vec2 ent_pos    = entity->position;
-	Vec2 player_pos = {.x = player_state->tile_x,
-			   .y = player_state->tile_y};
-
-	AStarNode open_nodes[MAX_ASTAR_NODES] = {0};
-	AStarHashMap closed_nodes             = {.data = {{0}}};
-	i32 open_nodes_length                 = 0;
-
-	open_nodes[open_nodes_length].position.x = ent_pos.x;
-	open_nodes[open_nodes_length].position.y = ent_pos.y;
-	open_nodes[open_nodes_length].parent.x   = -1;
-	open_nodes[open_nodes_length].parent.y   = -1;
-	open_nodes[open_nodes_length].g_cost     = 0;
-	open_nodes[open_nodes_length++].h_cost =
-		astar_compute_distance(player_pos, ent_pos);
-
-	AStarNode current_node = open_nodes[0];
-	i32 current_index      = 0;
-
-	while (open_nodes_length > 0 && open_nodes_length < MAX_ASTAR_NODES) {
-		current_node  = open_nodes[0];
-		current_index = 0;
-		/*
-		 * Find node with lowest fcost
-		 * NOTE: If this is slow, we can change to a min-heap
-		 */
-		for (i32 i = 0; i < open_nodes_length; i++) {
-			i32 probing_node_fcost =
-				astar_compute_fcost(open_nodes[i]);
-			i32 current_node_fcost =
-				astar_compute_fcost(current_node);
-
-			if (probing_node_fcost < current_node_fcost ||
-			    (probing_node_fcost == current_node_fcost &&
-			     open_nodes[i].h_cost < current_node.h_cost)) {
-				current_node  = open_nodes[i];
-				current_index = i;
-			}
-		}
 
-		/* Remove current node from open and add to closed */
-		u32 key = util_compactify_two_u32((u32)current_node.position.x,
-						  (u32)current_node.position.y);
-		hash_insert_astar(&closed_nodes, key, current_node);
-		open_nodes_length = astar_delete_open_node(
-			open_nodes, current_index, open_nodes_length);
+	PathBuffer *path = ent_get_path(entities, entity);
+	if (!path)
+		return;
 
-		/* If this is our target, we're done */
-		if (current_node.position.x == player_pos.x &&
-		    current_node.position.y == player_pos.y) {
-			break;
+	Planner *planners = (Planner *)mem_rel_get(
+		&context->world_state->planners);
+	Planner *planner = path_cache->planner >= 0 ?
+		&planners[path_cache->planner] :
+		NULL;
+
+	if (planner && planner->owner == ent_handle(entities, entity) &&
+	    (intent->plan_budget > 0 || !intent->plan_only)) {
+		intent->work = plan_update(planner, context->map_segment,
+					   position, goal,
+					   intent->plan_budget);
+
+		if (planner->search_done) {
+			ai__copy_path(path, planner);
+			path_cache->next = 0;
 		}
+	}
 
-		Vec2 neighbors[4] = {
-			{current_node.position.x, current_node.position.y - 1},
-			{current_node.position.x + 1, current_node.position.y},
-			{current_node.position.x, current_node.position.y + 1},
-			{current_node.position.x - 1, current_node.position.y},
-		};
-
-		for (i32 i = 0; i < 4; i++) {
-			Vec2 neighbor = neighbors[i];
-			i32 map_segment_index =
-				world_state->current_map_segment->index;
-			u32 tprop_key = util_compactify_three_u32(
-				(u32)map_segment_index, (u32)neighbor.x,
-				(u32)neighbor.y);
-			u64 tile_props = hash_get_int(&world_state->tile_props,
-						      tprop_key);
-			/* If neighbor not traversable, skip */
-			if ((tile_props & TPROP_HAS_COLLISION) ||
-			    (tile_props & TPROP_ENTITY)) {
-				continue;
-			}
+	if (intent->plan_only || path_cache->next >= path->length)
+		return;
 
-			u32 closed_key = util_compactify_two_u32(
-				(u32)neighbor.x, (u32)neighbor.y);
-			AStarNode closed_node =
-				hash_get_astar(&closed_nodes, closed_key);
+	i32 cell  = path->cells[path_cache->next];
+	Vec2 step = {.x = cell % SCREEN_WIDTH_TILES,
+		     .y = cell / SCREEN_WIDTH_TILES};
 
-			/* If neighbor already closed, skip */
-			if (closed_node.position.x > -1) {
-				continue;
-			}
+	/* An old path is only any use while the entity is still on it */
+	if (util_abs(step.x - position.x) + util_abs(step.y - position.y) != 1)
+		return;
 
-			i32 new_cost_to_neighbor = current_node.g_cost +
-				astar_compute_distance(current_node.position,
-						       neighbor);
-			i32 neighbor_index = astar_find_open_node(
-				open_nodes, neighbor, open_nodes_length);
-
-			if (neighbor_index < 0) {
-				/*
-				 * Add neighbor to open nodes and set
-				 * parent to current node
-				 */
-				AStarNode new_node = {
-					.position = {neighbor.x, neighbor.y},
-					.parent   = {current_node.position.x,
-                                                   current_node.position.y},
-					.g_cost   = new_cost_to_neighbor,
-					.h_cost   = astar_compute_distance(
-                                                neighbor, player_pos)};
-
-				open_nodes[open_nodes_length++] = new_node;
-			} else if (new_cost_to_neighbor <
-				   open_nodes[neighbor_index].g_cost) {
-				/*
-				 * Update parent and g and h costs of neighbor
-				 * if already in open nodes
-				 */
-				open_nodes[neighbor_index].parent.x =
-					current_node.position.x;
-				open_nodes[neighbor_index].parent.y =
-					current_node.position.y;
-				open_nodes[neighbor_index].g_cost =
-					new_cost_to_neighbor;
-				open_nodes[neighbor_index].h_cost =
-					astar_compute_distance(neighbor,
-							       player_pos);
-			}
-		}
-	}
+	intent->wants_move  = true;
+	intent->move_target = step;
+	intent->path_next   = path_cache->next + 1;
+}
 
-	/* Retrace path to start */
-	Vec2 path_positions[MAX_ASTAR_NODES] = {0};
-	i32 path_position_length             = 0;
+/*
+ * Moves go through in commit order. A tile that's already reserved, by an
+ * entity that was there at the start of the turn or one that moved in
+ * earlier this turn, makes the entity wait.
+ */
+static void ai_enemy_chase_commit(AIContext *context, AIIntent *intent,
+				  ReservationTable *reservations)
+{
+	if (!intent->wants_move)
+		return;
 
-	path_positions[path_position_length++] = current_node.position;
+	EntityPool *entities = context->entities;
+	i32 entity           = intent->entity;
+	Vec2 current   = ((Vec2 *)mem_rel_get(&entities->position))[entity];
+	Vec2 target    = intent->move_target;
+	u64 target_bit = (u64)1 << target.x;
+	PathCache *path_cache = (PathCache *)mem_rel_get(&entities->path_cache);
 
-	Vec2 parent = current_node.parent;
-	while (path_position_length < MAX_ASTAR_NODES) {
-		if (parent.x == ent_pos.x && parent.y == ent_pos.y) {
-			break;
-		}
+	if (reservations->rows[target.y] & target_bit)
+		return;
 
-		u32 key = util_compactify_two_u32((u32)parent.x, (u32)parent.y);
-		AStarNode parent_node = hash_get_astar(&closed_nodes, key);
+	reservations->rows[current.y] &= ~((u64)1 << current.x);
+	reservations->rows[target.y] |= target_bit;
+	path_cache[entity].next = intent->path_next;
 
-		if (parent_node.position.x < 0)
-			break;
+	ai_update_entity_position(context->world_state, entity,
+				  context->map_segment, target);
+}
+
+/*
+ * Coarse simulation for segments away from the player. Every
+ * LOD_TURNS_PER_PASS turns a new pass starts, and each entity in a
+ * low-detail segment gets one cheap step: chasers wander to a random free
+ * neighbouring tile and idle entities look around. Passes walk the pool a
+ * slice at a time, visiting at most LOD_MAX_ENTITIES_PER_FRAME slots per
+ * frame, so cost stays bounded no matter how populated the world is. A pass
+ * that runs long delays the next one rather than being cut short.
+ *
+ * is_full_detail[i] marks segments that ai_run_ai_system is handling.
+ */
+void ai_run_lod_system(MapSegment *map_segments, bool *is_full_detail,
+		       WorldState *world_state)
+{
+	EntityPool *entities = &world_state->entities;
+	LodState *lod        = &world_state->lod;
+	i32 *segments        = (i32 *)mem_rel_get(&entities->segment);
+	Vec2 *positions      = (Vec2 *)mem_rel_get(&entities->position);
+	AIStateIndex *ai_state =
+		(AIStateIndex *)mem_rel_get(&entities->ai_state);
+	Direction *face_direction =
+		(Direction *)mem_rel_get(&entities->face_direction);
+
+	if (lod->frames_until_pass > 0) {
+		lod->frames_until_pass--;
+	}
 
-		path_positions[path_position_length++] = parent_node.position;
-		parent                                 = parent_node.parent;
+	if (lod->frames_until_pass == 0 &&
+	    lod->next_slot >= entities->num_slots) {
+		lod->frames_until_pass =
+			LOD_TURNS_PER_PASS * world_state->turn_duration;
+		lod->pass++;
+		lod->next_slot = 0;
 	}
 
-	/* Store first several node positions with entity */
-	i32 j = 0;
-	for (i32 i = path_position_length - 1; i >= 0; i--) {
-		if (j >= MAX_PATH_LENGTH)
+	i32 end = lod->next_slot + LOD_MAX_ENTITIES_PER_FRAME;
+	if (end > entities->num_slots) {
+		end = entities->num_slots;
+	}
+
+	for (; lod->next_slot < end; lod->next_slot++) {
+		i32 entity        = lod->next_slot;
+		i32 segment_index = segments[entity];
+
+		if (segment_index < 0 || is_full_detail[segment_index])
+			continue;
+
+		MapSegment *map_segment = &map_segments[segment_index];
+		Vec2 position           = positions[entity];
+		u32 roll = util_hash_u32(ent_handle(entities, entity) ^
+					 (lod->pass * 0x9E3779B9u));
+		Direction direction = (Direction)(UPDIR + (i32)(roll % 4));
+
+		if (ai_state[entity] != AIST_ENEMY_CHASE) {
+			face_direction[entity] = direction;
+			continue;
+		}
+
+		Vec2 target = position;
+		switch (direction) {
+		case UPDIR:
+			target.y--;
+			break;
+		case RIGHTDIR:
+			target.x++;
+			break;
+		case DOWNDIR:
+			target.y++;
 			break;
+		default:
+			target.x--;
+			break;
+		}
+
+		if (occ_is_opaque(map_segment, target.x, target.y))
+			continue;
 
-		entity->path_cache.data[j] = path_positions[i];
-		j++;
+		ai_update_entity_position(world_state, entity, map_segment,
+					  target);
 	}
+}
 
-	entity->path_cache.length = j;
-	entity->path_counter      = MAX_PATH_LENGTH;
+/*
+ * Called when a segment moves between full and low detail. Chasers leaving
+ * full detail hand their planners and path buffers back and the segment's turn
+ * queue is emptied. Entities coming back are queued to act at once, with a
+ * fresh look around.
+ */
+void ai_set_segment_detail(MapSegment *map_segment, WorldState *world_state,
+			   bool full_detail)
+{
+	EntityPool *entities  = &world_state->entities;
+	SegmentEntities *list = &map_segment->entities;
+	i32 *list_next        = (i32 *)mem_rel_get(&entities->list_next);
+	FieldOfView *fov      = (FieldOfView *)mem_rel_get(&entities->fov);
+
+	if (!full_detail) {
+		sched_clear(entities, &list->turns);
+	}
 
-	ai_update_entity_position(entity, world_state);
-	entity->path_counter--;
+	for (i32 state = 0; state < AIST_COUNT; state++) {
+		for (i32 entity = list->state_head[state]; entity >= 0;
+		     entity = list_next[entity]) {
+			if (full_detail) {
+				fov[entity].dirty = true;
+				sched_insert(entities, &list->turns, entity,
+					     world_state->frame_clock);
+			} else {
+				ai__release_path(world_state, entity);
+			}
+		}
+	}
 }
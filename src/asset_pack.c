@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: <stdio.h>, <string.h>, game.h
+ */
+
+/*
+ * The asset pack holds every asset in one file, so the platform opens and
+ * maps a single file at startup instead of one per asset.
+ * tools/pack_assets.js builds it from the resources folder.
+ *
+ * An AssetPackHeader points at a table of AssetPackEntries. Each entry
+ * names an asset by its loose file path and says where it sits in the pack.
+ * Assets are stored ready to use: bitmaps in the native layout (see
+ * NativeBitmapHeader), tile maps as the tool was given them, and sounds as
+ * bare samples in the format the platform plays. Each asset starts on an
+ * ASSET_PACK_ALIGNMENT boundary.
+ *
+ * The platform hands out views into the pack in place of mapping files,
+ * so loaders don't know whether their asset came from the pack.
+ */
+
+static bool pack__is_entry(AssetView pack, const AssetPackEntry *entry);
+
+/* Checks the whole table, so pack_find can trust it afterwards */
+bool pack_check(AssetView pack, const char file_path[])
+{
+	const AssetPackHeader *header = (const AssetPackHeader *)pack.data;
+
+	if (pack.size < sizeof(AssetPackHeader) ||
+	    header->magic != ASSET_PACK_MAGIC ||
+	    header->version != ASSET_PACK_VERSION ||
+	    (header->entries_offset & (ASSET_PACK_ALIGNMENT - 1)) != 0 ||
+	    header->entries_offset > pack.size ||
+	    header->num_entries > (pack.size - header->entries_offset) /
+			    sizeof(AssetPackEntry)) {
+		fprintf(stderr, "asset pack: %s has an unsupported header\n",
+			file_path);
+		return false;
+	}
+
+	const AssetPackEntry *entries =
+		(const AssetPackEntry *)((const unsigned char *)pack.data +
+					 header->entries_offset);
+
+	for (u32 i = 0; i < header->num_entries; i++) {
+		if (!pack__is_entry(pack, &entries[i])) {
+			fprintf(stderr, "asset pack: entry %u of %s is bad\n",
+				i, file_path);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * The named asset's data, or an empty view if it isn't in the pack. There
+ * are only a handful of entries, so they're searched in order.
+ */
+AssetView pack_find(AssetView pack, const char name[])
+{
+	AssetView result = {0};
+
+	if (!pack.data)
+		return result;
+
+	const AssetPackHeader *header = (const AssetPackHeader *)pack.data;
+	const unsigned char *base     = (const unsigned char *)pack.data;
+	const AssetPackEntry *entries =
+		(const AssetPackEntry *)(base + header->entries_offset);
+
+	for (u32 i = 0; i < header->num_entries; i++) {
+		if (strcmp(entries[i].name, name) != 0)
+			continue;
+
+		result.data = base + entries[i].offset;
+		result.size = entries[i].size;
+		break;
+	}
+
+	return result;
+}
+
+/* Whether view is part of the pack, and so mustn't be unmapped itself */
+bool pack_contains(AssetView pack, AssetView view)
+{
+	const unsigned char *start = (const unsigned char *)pack.data;
+	const unsigned char *data  = (const unsigned char *)view.data;
+
+	return start && data >= start && data < start + pack.size;
+}
+
+static bool pack__is_entry(AssetView pack, const AssetPackEntry *entry)
+{
+	return memchr(entry->name, 0, sizeof(entry->name)) != NULL &&
+		(entry->offset & (ASSET_PACK_ALIGNMENT - 1)) == 0 &&
+		entry->offset <= pack.size &&
+		entry->size <= pack.size - entry->offset && entry->size > 0;
+}
@@ -0,0 +1,1324 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Headless platform layer for benchmarks. Builds the same game code as
+ * sdl_main.c but needs nothing beyond libc and pthreads. Usage:
+ *
+ *	bench_udc stress [entity_count ...]
+ *	bench_udc chasers [chaser_count ...]
+ *	bench_udc ai
+ *	bench_udc bmp
+ *	bench_udc replay [replay_file]
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+typedef int8_t i8;
+typedef int16_t i16;
+typedef int32_t i32;
+typedef int64_t i64;
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#include "game.h"
+#include "util.c"
+#include "memory.c"
+#include "bitmap.c"
+#include "occupancy.c"
+#include "fov.c"
+#include "planner.c"
+#include "scheduler.c"
+#include "entity.c"
+#include "ai.c"
+#include "tile_map.c"
+#include "world.c"
+#include "game.c"
+#include "replay.c"
+
+#define MAX_WORKER_THREADS 8
+#define MAX_ASSET_LOADS 32
+#define BENCH_STORAGE_SIZE (32 * 1024 * 1024)
+#define BENCH_WORLD_WIDTH 8
+#define BENCH_WORLD_HEIGHT 8
+#define BENCH_WARMUP_FRAMES 64
+#define BENCH_FRAMES 480
+#define BENCH_MAPS_PER_KIND 32
+#define BENCH_PAIRS_PER_MAP 64
+#define BENCH_STEPS_PER_PAIR 4
+#define BENCH_MAX_ROOMS 8
+#define BENCH_REPLAY_PATH "replay.bin"
+#define BENCH_BMP_SIZE 4096
+#define BENCH_BMP_RUNS 8
+
+/* Same scheme as the SDL worker pool, on POSIX threads */
+typedef struct WorkerPool {
+	pthread_t threads[MAX_WORKER_THREADS];
+	i32 num_threads;
+	sem_t work_ready;
+	sem_t work_done;
+	i32 next_index;
+	void (*func)(void *, i32);
+	void *data;
+	i32 count;
+	bool should_quit;
+} WorkerPool;
+
+typedef enum {
+	BENCH_MAP_CAVES,
+	BENCH_MAP_ROOMS,
+	BENCH_MAP_FIELD,
+	BENCH_MAP_MAZE,
+	BENCH_MAP_COUNT
+} BenchMapKind;
+
+/* Bit x of row y is set for a wall at (x, y) */
+typedef struct BenchMap {
+	u64 rows[SCREEN_HEIGHT_TILES];
+} BenchMap;
+
+typedef struct AIBenchResult {
+	i32 chase_queries;
+	i32 unreachable;
+	i64 chase_ns;
+	i64 chase_nodes;
+	i64 path_length;
+	i32 step_queries;
+	i64 step_ns;
+	i64 step_nodes;
+	i64 fresh_ns;
+	i64 fresh_nodes;
+	i32 idle_queries;
+	i32 sightings;
+	i64 idle_ns;
+	i64 idle_tiles;
+} AIBenchResult;
+
+typedef struct StressResult {
+	i32 num_spawned;
+	i32 num_full_detail;
+	i64 ai_ns;
+	i64 ai_max_ns;
+	i64 move_ns;
+	i64 render_ns;
+} StressResult;
+
+typedef struct ChaseResult {
+	i32 num_spawned;
+	i64 ai_ns;
+	i64 ai_max_ns;
+	i32 handoffs; /* planners taken by a new owner */
+} ChaseResult;
+
+static WorkerPool worker_pool;
+
+/* What each load came to; the benchmark runs loads as they're asked for */
+static size_t asset_load_sizes[MAX_ASSET_LOADS];
+static i32 num_asset_loads;
+
+static const char *bench_map_names[BENCH_MAP_COUNT] = {"caves", "rooms",
+						       "field", "maze"};
+
+static void start_worker_pool(WorkerPool *pool);
+static void stop_worker_pool(WorkerPool *pool);
+static void *worker_thread_main(void *data);
+static void run_parallel_jobs(WorkerPool *pool);
+static i64 bench_now_ns(void);
+static u32 bench_random(u32 *state);
+static bool bench_setup_memory(Memory *memory, void *storage,
+			       i32 entity_capacity);
+static void bench_build_world(Memory *memory, u32 seed);
+static void bench_generate_map(BenchMap *map, BenchMapKind kind, u32 seed);
+static void bench_generate_caves(BenchMap *map, u32 *random);
+static void bench_generate_rooms(BenchMap *map, u32 *random);
+static void bench_generate_maze(BenchMap *map, u32 *random);
+static bool bench_is_wall(BenchMap *map, i32 x, i32 y);
+static void bench_set_wall(BenchMap *map, i32 x, i32 y, bool is_wall);
+static void bench_load_map(MapSegment *map_segment, BenchMap *map);
+static Vec2 bench_random_free_tile(MapSegment *map_segment, u32 *random);
+static StressResult bench_run_stress(Memory *memory,
+				     ScreenState *screen_state,
+				     i32 num_entities, AIStateIndex state);
+static ChaseResult bench_run_chase(Memory *memory, i32 num_chasers);
+static AIBenchResult bench_run_ai(Memory *memory, BenchMapKind kind);
+static int bench_stress_main(int argc, char *argv[], AIStateIndex state);
+static int bench_chase_main(int argc, char *argv[]);
+static int bench_ai_main(void);
+static size_t bench_build_bmp(unsigned char **file, i32 bits, u32 seed);
+static int bench_bmp_main(void);
+static int bench_replay_main(int argc, char *argv[]);
+
+int main(int argc, char *argv[])
+{
+	int ret = 1;
+
+	start_worker_pool(&worker_pool);
+
+	if (argc >= 2 && strcmp(argv[1], "stress") == 0) {
+		ret = bench_stress_main(argc, argv, AIST_ENEMY_CHASE);
+	} else if (argc >= 2 && strcmp(argv[1], "sleep") == 0) {
+		ret = bench_stress_main(argc, argv, AIST_ENEMY_IDLE);
+	} else if (argc >= 2 && strcmp(argv[1], "chasers") == 0) {
+		ret = bench_chase_main(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "ai") == 0) {
+		ret = bench_ai_main();
+	} else if (argc >= 2 && strcmp(argv[1], "bmp") == 0) {
+		ret = bench_bmp_main();
+	} else if (argc >= 2 && strcmp(argv[1], "replay") == 0) {
+		ret = bench_replay_main(argc, argv);
+	} else {
+		fprintf(stderr, "usage: %s stress [entity_count ...]\n",
+			argv[0]);
+		fprintf(stderr, "       %s sleep [entity_count ...]\n",
+			argv[0]);
+		fprintf(stderr, "       %s chasers [chaser_count ...]\n",
+			argv[0]);
+		fprintf(stderr, "       %s ai\n", argv[0]);
+		fprintf(stderr, "       %s bmp\n", argv[0]);
+		fprintf(stderr, "       %s replay [replay_file]\n", argv[0]);
+	}
+
+	stop_worker_pool(&worker_pool);
+
+	return ret;
+}
+
+i32 debug_platform_stream_audio(const char file_path[], FileStream *stream,
+				void *sound_buffer, i32 sound_buffer_size)
+{
+	(void)file_path;
+	(void)stream;
+	(void)sound_buffer;
+	(void)sound_buffer_size;
+
+	return 0;
+}
+
+size_t debug_platform_load_asset(const char file_path[], void *memory_location,
+				 size_t max_size)
+{
+	FILE *file = fopen(file_path, "rb");
+
+	if (file == NULL)
+		return 0;
+
+	fseek(file, 0, SEEK_END);
+	size_t file_size = (size_t)ftell(file);
+	rewind(file);
+
+	size_t result = 0;
+	if (file_size <= max_size) {
+		result = fread(memory_location, 1, file_size, file);
+	}
+
+	fclose(file);
+
+	return result == file_size ? result : 0;
+}
+
+/* Maps the whole file read-only; see AssetView */
+AssetView platform_map_asset(const char file_path[])
+{
+	AssetView view = {0};
+	struct stat file_stat;
+	int fd = open(file_path, O_RDONLY);
+
+	if (fd < 0)
+		return view;
+
+	/* Empty files can't be mapped */
+	if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+		size_t size = (size_t)file_stat.st_size;
+		void *data  = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data != MAP_FAILED) {
+			view.data = data;
+			view.size = size;
+		}
+	}
+
+	/* The mapping stays good after the file is closed */
+	close(fd);
+
+	return view;
+}
+
+void platform_unmap_asset(AssetView view)
+{
+	if (view.data) {
+		munmap((void *)view.data, view.size);
+	}
+}
+
+i32 platform_request_asset_load(const char file_path[], void *memory_location,
+				size_t max_size,
+				size_t (*func)(const char[], void *, size_t))
+{
+	i32 handle = num_asset_loads;
+
+	num_asset_loads = (num_asset_loads + 1) % MAX_ASSET_LOADS;
+
+	if (!func) {
+		func = &debug_platform_load_asset;
+	}
+
+	asset_load_sizes[handle] = func(file_path, memory_location, max_size);
+
+	return handle;
+}
+
+AssetLoadState platform_poll_asset_load(i32 handle, size_t *loaded_size)
+{
+	size_t result = platform_wait_asset_load(handle);
+
+	if (loaded_size) {
+		*loaded_size = result;
+	}
+
+	return result ? ASSET_LOAD_DONE : ASSET_LOAD_FAILED;
+}
+
+size_t platform_wait_asset_load(i32 handle)
+{
+	if (handle < 0 || handle >= MAX_ASSET_LOADS)
+		return 0;
+
+	return asset_load_sizes[handle];
+}
+
+void platform_parallel_for(void (*func)(void *, i32), void *data, i32 count)
+{
+	WorkerPool *pool = &worker_pool;
+
+	if (pool->num_threads == 0 || count < 2) {
+		for (i32 i = 0; i < count; i++) {
+			func(data, i);
+		}
+		return;
+	}
+
+	pool->func  = func;
+	pool->data  = data;
+	pool->count = count;
+	__atomic_store_n(&pool->next_index, 0, __ATOMIC_SEQ_CST);
+
+	for (i32 i = 0; i < pool->num_threads; i++) {
+		sem_post(&pool->work_ready);
+	}
+
+	run_parallel_jobs(pool);
+
+	for (i32 i = 0; i < pool->num_threads; i++) {
+		sem_wait(&pool->work_done);
+	}
+}
+
+/* UDC_WORKER_THREADS overrides the default of one worker per spare core */
+static void start_worker_pool(WorkerPool *pool)
+{
+	i32 num_threads = (i32)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+
+	char *override = getenv("UDC_WORKER_THREADS");
+	if (override) {
+		num_threads = atoi(override);
+	}
+
+	if (num_threads > MAX_WORKER_THREADS)
+		num_threads = MAX_WORKER_THREADS;
+
+	if (num_threads <= 0)
+		return;
+
+	sem_init(&pool->work_ready, 0, 0);
+	sem_init(&pool->work_done, 0, 0);
+
+	for (i32 i = 0; i < num_threads; i++) {
+		if (pthread_create(&pool->threads[pool->num_threads], NULL,
+				   worker_thread_main, pool) != 0) {
+			fprintf(stderr, "Failed to create worker thread\n");
+			break;
+		}
+
+		pool->num_threads++;
+	}
+}
+
+static void stop_worker_pool(WorkerPool *pool)
+{
+	if (pool->num_threads == 0)
+		return;
+
+	pool->should_quit = true;
+
+	for (i32 i = 0; i < pool->num_threads; i++) {
+		sem_post(&pool->work_ready);
+	}
+
+	for (i32 i = 0; i < pool->num_threads; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	pool->num_threads = 0;
+	sem_destroy(&pool->work_ready);
+	sem_destroy(&pool->work_done);
+}
+
+static void *worker_thread_main(void *data)
+{
+	WorkerPool *pool = (WorkerPool *)data;
+
+	for (;;) {
+		sem_wait(&pool->work_ready);
+
+		if (pool->should_quit)
+			break;
+
+		run_parallel_jobs(pool);
+		sem_post(&pool->work_done);
+	}
+
+	return NULL;
+}
+
+static void run_parallel_jobs(WorkerPool *pool)
+{
+	for (;;) {
+		i32 index = __atomic_fetch_add(&pool->next_index, 1,
+					       __ATOMIC_SEQ_CST);
+		if (index >= pool->count)
+			break;
+
+		pool->func(pool->data, index);
+	}
+}
+
+static i64 bench_now_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (i64)now.tv_sec * 1000000000 + (i64)now.tv_nsec;
+}
+
+/* xorshift32, state must not be 0 */
+static u32 bench_random(u32 *state)
+{
+	u32 x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x;
+}
+
+/*
+ * Resets memory to a fresh world with room for entity_capacity entities,
+ * plus a plain two-tile tile set so rendering does real work.
+ */
+static bool bench_setup_memory(Memory *memory, void *storage,
+			       i32 entity_capacity)
+{
+	memset(memory, 0, sizeof(*memory));
+	memset(storage, 0, BENCH_STORAGE_SIZE);
+
+	mem_rel_set(&memory->temp_storage, storage);
+	memory->temp_storage_size = BENCH_STORAGE_SIZE;
+
+	if (!init_world_systems(memory, entity_capacity))
+		return false;
+
+	i32 width   = 2 * TILE_WIDTH;
+	i32 height  = TILE_HEIGHT;
+	Bitmap *bmp = (Bitmap *)mem_push_permanent(
+		memory, sizeof(Bitmap) + (size_t)(width * height) * 4,
+		MEM_TAG_BENCH);
+
+	if (!bmp)
+		return false;
+
+	bmp->width  = width;
+	bmp->height = height;
+
+	u32 *pixels = (u32 *)bmp->data;
+	for (i32 i = 0; i < width * height; i++) {
+		pixels[i] = (i % width) < TILE_WIDTH ? 0xFF303030 : 0xFF806040;
+	}
+
+	mem_rel_set(&memory->world_state.tile_set, bmp);
+	memory->world_state.turn_duration = 8;
+
+	bench_build_world(memory, 0x1234567);
+
+	return true;
+}
+
+/* A grid of connected segments, each an open field */
+static void bench_build_world(Memory *memory, u32 seed)
+{
+	WorldState *world_state = &memory->world_state;
+
+	world_state->num_segments = BENCH_WORLD_WIDTH * BENCH_WORLD_HEIGHT;
+
+	for (i32 y = 0; y < BENCH_WORLD_HEIGHT; y++) {
+		for (i32 x = 0; x < BENCH_WORLD_WIDTH; x++) {
+			i32 index = y * BENCH_WORLD_WIDTH + x;
+			MapSegment *map_segment =
+				world_place_segment(world_state, index);
+			BenchMap map;
+
+			if (y > 0) {
+				map_segment->top_connection =
+					index - BENCH_WORLD_WIDTH;
+			}
+			if (x < BENCH_WORLD_WIDTH - 1) {
+				map_segment->right_connection = index + 1;
+			}
+			if (y < BENCH_WORLD_HEIGHT - 1) {
+				map_segment->bottom_connection =
+					index + BENCH_WORLD_WIDTH;
+			}
+			if (x > 0) {
+				map_segment->left_connection = index - 1;
+			}
+
+			bench_generate_map(&map, BENCH_MAP_FIELD,
+					   seed + (u32)index);
+			bench_load_map(map_segment, &map);
+		}
+	}
+}
+
+static void bench_generate_map(BenchMap *map, BenchMapKind kind, u32 seed)
+{
+	/* xorshift gets stuck on 0 */
+	u32 random = seed * 0x9E3779B9u | 1;
+
+	memset(map, 0, sizeof(*map));
+
+	switch (kind) {
+	case BENCH_MAP_CAVES:
+		bench_generate_caves(map, &random);
+		break;
+	case BENCH_MAP_ROOMS:
+		bench_generate_rooms(map, &random);
+		break;
+	case BENCH_MAP_FIELD:
+		for (i32 y = 0; y < SCREEN_HEIGHT_TILES; y++) {
+			for (i32 x = 0; x < SCREEN_WIDTH_TILES; x++) {
+				bool is_wall = bench_random(&random) % 100 < 10;
+				bench_set_wall(map, x, y, is_wall);
+			}
+		}
+		break;
+	case BENCH_MAP_MAZE:
+		bench_generate_maze(map, &random);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Random fill smoothed by a few rounds of a cellular automaton */
+static void bench_generate_caves(BenchMap *map, u32 *random)
+{
+	for (i32 y = 0; y < SCREEN_HEIGHT_TILES; y++) {
+		for (i32 x = 0; x < SCREEN_WIDTH_TILES; x++) {
+			bool is_wall = bench_random(random) % 100 < 45;
+			bench_set_wall(map, x, y, is_wall);
+		}
+	}
+
+	for (i32 round = 0; round < 4; round++) {
+		BenchMap next;
+
+		for (i32 y = 0; y < SCREEN_HEIGHT_TILES; y++) {
+			for (i32 x = 0; x < SCREEN_WIDTH_TILES; x++) {
+				i32 walls = 0;
+
+				for (i32 dy = -1; dy <= 1; dy++) {
+					for (i32 dx = -1; dx <= 1; dx++) {
+						walls += bench_is_wall(
+							map, x + dx, y + dy);
+					}
+				}
+
+				bench_set_wall(&next, x, y, walls >= 5);
+			}
+		}
+
+		*map = next;
+	}
+}
+
+/* Rectangular rooms, each joined to the last by an L-shaped corridor */
+static void bench_generate_rooms(BenchMap *map, u32 *random)
+{
+	memset(map->rows, 0xFF, sizeof(map->rows));
+
+	Vec2 previous = {0};
+
+	for (i32 room = 0; room < BENCH_MAX_ROOMS; room++) {
+		i32 width  = 4 + (i32)(bench_random(random) % 7);
+		i32 height = 3 + (i32)(bench_random(random) % 4);
+		i32 min_x  = 1 + (i32)(bench_random(random) %
+				       (u32)(SCREEN_WIDTH_TILES - width - 1));
+		i32 min_y  = 1 + (i32)(bench_random(random) %
+				       (u32)(SCREEN_HEIGHT_TILES - height - 1));
+		Vec2 center = {min_x + width / 2, min_y + height / 2};
+
+		for (i32 y = min_y; y < min_y + height; y++) {
+			for (i32 x = min_x; x < min_x + width; x++) {
+				bench_set_wall(map, x, y, false);
+			}
+		}
+
+		if (room > 0) {
+			i32 step_x = center.x < previous.x ? 1 : -1;
+			i32 step_y = center.y < previous.y ? 1 : -1;
+
+			for (i32 x = center.x; x != previous.x; x += step_x) {
+				bench_set_wall(map, x, center.y, false);
+			}
+			for (i32 y = center.y; y != previous.y; y += step_y) {
+				bench_set_wall(map, previous.x, y, false);
+			}
+		}
+
+		previous = center;
+	}
+}
+
+/*
+ * Depth-first backtracking maze. Cells sit on odd coordinates with the
+ * walls between them on even ones.
+ */
+static void bench_generate_maze(BenchMap *map, u32 *random)
+{
+	enum {
+		CELLS_X = (SCREEN_WIDTH_TILES - 1) / 2,
+		CELLS_Y = (SCREEN_HEIGHT_TILES - 1) / 2
+	};
+	static const Vec2 steps[4] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+
+	Vec2 stack[CELLS_X * CELLS_Y];
+	i32 stack_length = 0;
+
+	memset(map->rows, 0xFF, sizeof(map->rows));
+
+	stack[stack_length++] = (Vec2){0, 0};
+	bench_set_wall(map, 1, 1, false);
+
+	while (stack_length > 0) {
+		Vec2 cell = stack[stack_length - 1];
+		Vec2 options[4];
+		i32 num_options = 0;
+
+		for (i32 i = 0; i < 4; i++) {
+			Vec2 next = {cell.x + steps[i].x, cell.y + steps[i].y};
+
+			if (next.x < 0 || next.x >= CELLS_X || next.y < 0 ||
+			    next.y >= CELLS_Y)
+				continue;
+
+			if (bench_is_wall(map, 2 * next.x + 1,
+					  2 * next.y + 1)) {
+				options[num_options++] = next;
+			}
+		}
+
+		if (!num_options) {
+			stack_length--;
+			continue;
+		}
+
+		Vec2 next =
+			options[bench_random(random) % (u32)num_options];
+
+		bench_set_wall(map, cell.x + next.x + 1, cell.y + next.y + 1,
+			       false);
+		bench_set_wall(map, 2 * next.x + 1, 2 * next.y + 1, false);
+		stack[stack_length++] = next;
+	}
+}
+
+/* Anything off the map counts as wall */
+static bool bench_is_wall(BenchMap *map, i32 x, i32 y)
+{
+	if (x < 0 || x >= SCREEN_WIDTH_TILES || y < 0 ||
+	    y >= SCREEN_HEIGHT_TILES)
+		return true;
+
+	return !!(map->rows[y] & ((u64)1 << x));
+}
+
+static void bench_set_wall(BenchMap *map, i32 x, i32 y, bool is_wall)
+{
+	if (is_wall) {
+		map->rows[y] |= (u64)1 << x;
+	} else {
+		map->rows[y] &= ~((u64)1 << x);
+	}
+}
+
+static void bench_load_map(MapSegment *map_segment, BenchMap *map)
+{
+	memset(&map_segment->occupancy, 0, sizeof(map_segment->occupancy));
+
+	for (i32 y = 0; y < SCREEN_HEIGHT_TILES; y++) {
+		for (i32 x = 0; x < SCREEN_WIDTH_TILES; x++) {
+			bool is_wall = bench_is_wall(map, x, y);
+
+			map_segment->tiles[y][x] = (1 << TM_BG_TILE_SHIFT) |
+				(is_wall ? 2u : 0u);
+
+			if (is_wall) {
+				occ_set_collision(map_segment, x, y);
+			}
+		}
+	}
+}
+
+/* Returns {-1, -1} if no free tile turned up */
+static Vec2 bench_random_free_tile(MapSegment *map_segment, u32 *random)
+{
+	for (i32 attempt = 0; attempt < 1000; attempt++) {
+		Vec2 tile = {
+			.x = (i32)(bench_random(random) % SCREEN_WIDTH_TILES),
+			.y = (i32)(bench_random(random) % SCREEN_HEIGHT_TILES),
+		};
+
+		if (!occ_is_opaque(map_segment, tile.x, tile.y))
+			return tile;
+	}
+
+	return (Vec2){-1, -1};
+}
+
+/*
+ * Spreads num_entities entities in the given state evenly over the world,
+ * puts the player in the middle of it and times the per-frame work of a
+ * turn-based chase. Only the segments around the player run full AI, so
+ * "near" is how many entities are getting the expensive treatment.
+ */
+static StressResult bench_run_stress(Memory *memory,
+				     ScreenState *screen_state,
+				     i32 num_entities, AIStateIndex state)
+{
+	WorldState *world_state   = &memory->world_state;
+	PlayerState *player_state = &memory->player_state;
+	StressResult result       = {0};
+	u32 random                = 0xC0FFEE;
+	i32 center                = (BENCH_WORLD_HEIGHT / 2) *
+			BENCH_WORLD_WIDTH +
+		BENCH_WORLD_WIDTH / 2;
+
+	world_state->current_map_segment = center;
+	player_state->tile_x             = SCREEN_WIDTH_TILES / 2;
+	player_state->tile_y             = SCREEN_HEIGHT_TILES / 2;
+
+	for (i32 i = 0; i < num_entities; i++) {
+		MapSegment *map_segment =
+			&world_state->map_segments[i % MAX_RESIDENT_SEGMENTS];
+
+		/* Give up on a full segment rather than spin */
+		for (i32 attempt = 0; attempt < 64; attempt++) {
+			Vec2 position = {
+				.x = (i32)(bench_random(&random) %
+					   SCREEN_WIDTH_TILES),
+				.y = (i32)(bench_random(&random) %
+					   SCREEN_HEIGHT_TILES),
+			};
+
+			if (map_segment->id == center &&
+			    position.x == player_state->tile_x &&
+			    position.y == player_state->tile_y)
+				continue;
+
+			Direction facing = (Direction)(
+				UPDIR + (i32)(bench_random(&random) % 4));
+
+			if (ai_spawn_entity(world_state, map_segment, position,
+					    facing, state) >= 0) {
+				result.num_spawned++;
+				break;
+			}
+		}
+	}
+
+	for (i32 frame = -BENCH_WARMUP_FRAMES; frame < BENCH_FRAMES; frame++) {
+		i64 start = bench_now_ns();
+		mem_reset_arena(&memory->frame_arena);
+		simulate_entities(memory);
+		i64 simulated = bench_now_ns();
+		move_entities(world_state, screen_state);
+		i64 moved = bench_now_ns();
+		render_hot_tiles(screen_state, world_state);
+		render_entities(screen_state->image_buffer, world_state);
+		i64 rendered = bench_now_ns();
+
+		if (frame < 0)
+			continue;
+
+		result.ai_ns += simulated - start;
+		result.move_ns += moved - simulated;
+		result.render_ns += rendered - moved;
+		if (simulated - start > result.ai_max_ns) {
+			result.ai_max_ns = simulated - start;
+		}
+	}
+
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		MapSegment *map_segment = &world_state->map_segments[i];
+		if (world_state->is_full_detail[i]) {
+			result.num_full_detail +=
+				map_segment->entities.num_entities;
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Puts num_chasers chasers in the player's segment and moves the player a
+ * tile every turn, counting how often a planner is taken by a new owner.
+ * Each handoff starts a search over, so past MAX_PLANNERS chasers this
+ * shows the pool thrashing.
+ */
+static ChaseResult bench_run_chase(Memory *memory, i32 num_chasers)
+{
+	WorldState *world_state   = &memory->world_state;
+	PlayerState *player_state = &memory->player_state;
+	Planner *planners = (Planner *)mem_rel_get(&world_state->planners);
+	EntityHandle owners[MAX_PLANNERS] = {0};
+	ChaseResult result = {0};
+	u32 random         = 0xFACADE;
+	static const Vec2 steps[4] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+	i32 center = (BENCH_WORLD_HEIGHT / 2) * BENCH_WORLD_WIDTH +
+		BENCH_WORLD_WIDTH / 2;
+	MapSegment *map_segment = world_get_segment(world_state, center);
+
+	world_state->current_map_segment = center;
+	player_state->tile_x             = SCREEN_WIDTH_TILES / 2;
+	player_state->tile_y             = SCREEN_HEIGHT_TILES / 2;
+
+	for (i32 i = 0; i < num_chasers; i++) {
+		Vec2 position = bench_random_free_tile(map_segment, &random);
+
+		if (position.x < 0 || (position.x == player_state->tile_x &&
+				       position.y == player_state->tile_y))
+			continue;
+
+		if (ai_spawn_entity(world_state, map_segment, position, UPDIR,
+				    AIST_ENEMY_CHASE) >= 0) {
+			result.num_spawned++;
+		}
+	}
+
+	for (i32 frame = -BENCH_WARMUP_FRAMES; frame < BENCH_FRAMES; frame++) {
+		if (frame % world_state->turn_duration == 0) {
+			Vec2 step = steps[bench_random(&random) % 4];
+			i32 x     = player_state->tile_x + step.x;
+			i32 y     = player_state->tile_y + step.y;
+
+			if (!occ_is_opaque(map_segment, x, y) &&
+			    !occ_entity_at(map_segment, x, y)) {
+				player_state->tile_x = x;
+				player_state->tile_y = y;
+			}
+		}
+
+		i64 start = bench_now_ns();
+		mem_reset_arena(&memory->frame_arena);
+		simulate_entities(memory);
+		i64 simulated = bench_now_ns();
+
+		for (i32 i = 0; i < world_state->num_planners; i++) {
+			if (planners[i].owner &&
+			    planners[i].owner != owners[i] && frame >= 0) {
+				result.handoffs++;
+			}
+			owners[i] = planners[i].owner;
+		}
+
+		if (frame < 0)
+			continue;
+
+		result.ai_ns += simulated - start;
+		if (simulated - start > result.ai_max_ns) {
+			result.ai_max_ns = simulated - start;
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Runs the AI's plan functions directly on generated segments. For each
+ * entity/player pair: a chase planned from scratch, a few turns of chasing
+ * a wandering player so the planner repairs its search instead, each set
+ * against a fresh search from the same tiles, and an idle entity checking
+ * its field of view.
+ */
+static AIBenchResult bench_run_ai(Memory *memory, BenchMapKind kind)
+{
+	WorldState *world_state = &memory->world_state;
+	EntityPool *entities    = &world_state->entities;
+	MapSegment *map_segment = &world_state->map_segments[0];
+	Planner *planners = (Planner *)mem_rel_get(&world_state->planners);
+	Vec2 *positions   = (Vec2 *)mem_rel_get(&entities->position);
+	Direction *facings =
+		(Direction *)mem_rel_get(&entities->face_direction);
+	FieldOfView *fov      = (FieldOfView *)mem_rel_get(&entities->fov);
+	PathCache *path_cache = (PathCache *)mem_rel_get(&entities->path_cache);
+	AIBenchResult result  = {0};
+	u32 random            = 0xBEEF + (u32)kind;
+	static const Vec2 steps[4] = {{0, -1}, {1, 0}, {0, 1}, {-1, 0}};
+
+	i32 entity = ent_alloc(entities, map_segment, AIST_ENEMY_CHASE);
+	path_cache[entity].planner = 0;
+	ent_alloc_path(entities, entity);
+
+	for (i32 map_number = 0; map_number < BENCH_MAPS_PER_KIND;
+	     map_number++) {
+		BenchMap map;
+		bench_generate_map(&map, kind, (u32)map_number + 1);
+		bench_load_map(map_segment, &map);
+
+		for (i32 pair = 0; pair < BENCH_PAIRS_PER_MAP; pair++) {
+			Vec2 start =
+				bench_random_free_tile(map_segment, &random);
+			Vec2 player =
+				bench_random_free_tile(map_segment, &random);
+
+			if (start.x < 0 || player.x < 0 ||
+			    (start.x == player.x && start.y == player.y))
+				continue;
+
+			AIContext context = {
+				.entities    = entities,
+				.world_state = world_state,
+				.map_segment = map_segment,
+				.player_pos  = player,
+			};
+			AIIntent intent = {.entity      = entity,
+					   .plan_budget = PLAN_NUM_CELLS};
+
+			positions[entity] = start;
+			plan_release(planners, world_state->num_planners,
+				     ent_handle(entities, entity));
+			planners[0].owner = ent_handle(entities, entity);
+
+			i64 begin = bench_now_ns();
+			ai_enemy_chase_plan(&context, &intent);
+			result.chase_ns += bench_now_ns() - begin;
+			result.chase_nodes += intent.work;
+			result.chase_queries++;
+
+			i32 path_length = planners[0].path_length;
+			result.path_length += path_length;
+			if (path_length == 0) {
+				result.unreachable++;
+			}
+
+			for (i32 step = 0;
+			     step < BENCH_STEPS_PER_PAIR && intent.wants_move;
+			     step++) {
+				Vec2 next = {
+					player.x + steps[step % 4].x,
+					player.y + steps[step % 4].y,
+				};
+				if (!occ_is_opaque(map_segment, next.x,
+						   next.y)) {
+					context.player_pos = next;
+				}
+
+				positions[entity] = intent.move_target;
+				intent = (AIIntent){
+					.entity      = entity,
+					.plan_budget = PLAN_NUM_CELLS,
+				};
+
+				begin = bench_now_ns();
+				ai_enemy_chase_plan(&context, &intent);
+				result.step_ns += bench_now_ns() - begin;
+				result.step_nodes += intent.work;
+				result.step_queries++;
+
+				planners[0].initialized = false;
+				begin = bench_now_ns();
+				result.fresh_nodes += plan_update(
+					&planners[0], map_segment,
+					positions[entity], context.player_pos,
+					PLAN_NUM_CELLS);
+				result.fresh_ns += bench_now_ns() - begin;
+			}
+
+			positions[entity] = start;
+			facings[entity] =
+				(Direction)(UPDIR + (i32)(random % 4));
+			fov[entity].dirty  = true;
+			context.player_pos = player;
+			intent = (AIIntent){.entity = entity};
+
+			begin = bench_now_ns();
+			ai_enemy_idle_plan(&context, &intent);
+			result.idle_ns += bench_now_ns() - begin;
+			result.idle_tiles += intent.work;
+			result.sightings += intent.sees_player;
+			result.idle_queries++;
+		}
+	}
+
+	return result;
+}
+
+static int bench_stress_main(int argc, char *argv[], AIStateIndex state)
+{
+	static Memory memory            = {0};
+	static ScreenState screen_state = {{0}, NULL, 0, {0}};
+	i32 default_counts[]            = {1000, 2500, 5000, 10000};
+	i32 num_counts                  = argc - 2;
+	int ret                         = 0;
+
+	void *storage             = aligned_alloc(64, BENCH_STORAGE_SIZE);
+	screen_state.image_buffer = (u32 *)malloc(WIN_WIDTH * WIN_HEIGHT * 4);
+
+	if (!storage || !screen_state.image_buffer) {
+		fprintf(stderr, "Failed to allocate benchmark memory\n");
+		ret = 1;
+		goto cleanup;
+	}
+
+	printf("worker threads: %d, frames: %d, turn: 8 frames\n",
+	       worker_pool.num_threads, BENCH_FRAMES);
+	printf("%9s %9s %12s %12s %12s %12s\n", "entities", "near",
+	       "ai us/frame", "ai max us", "move us", "render us");
+
+	for (i32 i = 0; i < (num_counts > 0 ? num_counts : 4); i++) {
+		i32 count = num_counts > 0 ? atoi(argv[i + 2])
+					   : default_counts[i];
+
+		if (!bench_setup_memory(&memory, storage, count)) {
+			fprintf(stderr, "%d entities don't fit in %d MiB\n",
+				count, BENCH_STORAGE_SIZE / (1024 * 1024));
+			ret = 1;
+			break;
+		}
+
+		StressResult result =
+			bench_run_stress(&memory, &screen_state, count, state);
+
+		printf("%9d %9d %12.1f %12.1f %12.1f %12.1f\n",
+		       result.num_spawned, result.num_full_detail,
+		       (double)result.ai_ns / BENCH_FRAMES / 1000.0,
+		       (double)result.ai_max_ns / 1000.0,
+		       (double)result.move_ns / BENCH_FRAMES / 1000.0,
+		       (double)result.render_ns / BENCH_FRAMES / 1000.0);
+	}
+
+cleanup:
+	free(screen_state.image_buffer);
+	free(storage);
+
+	return ret;
+}
+
+static int bench_chase_main(int argc, char *argv[])
+{
+	static Memory memory = {0};
+	i32 default_counts[] = {16, 32, 64, 96, 128, 256};
+	i32 num_counts       = argc - 2;
+	void *storage        = aligned_alloc(64, BENCH_STORAGE_SIZE);
+	int ret              = 0;
+
+	if (!storage) {
+		fprintf(stderr, "Failed to allocate benchmark memory\n");
+		return 1;
+	}
+
+	printf("planners: up to %d, frames: %d, turn: 8 frames\n",
+	       MAX_PLANNERS, BENCH_FRAMES);
+	printf("%9s %12s %12s %15s\n", "chasers", "ai us/frame", "ai max us",
+	       "handoffs/turn");
+
+	for (i32 i = 0; i < (num_counts > 0 ? num_counts : 6); i++) {
+		i32 count = num_counts > 0 ? atoi(argv[i + 2])
+					   : default_counts[i];
+
+		if (!bench_setup_memory(&memory, storage, count)) {
+			fprintf(stderr, "%d entities don't fit in %d MiB\n",
+				count, BENCH_STORAGE_SIZE / (1024 * 1024));
+			ret = 1;
+			break;
+		}
+
+		ChaseResult result = bench_run_chase(&memory, count);
+		i32 turns = BENCH_FRAMES / memory.world_state.turn_duration;
+
+		printf("%9d %12.1f %12.1f %15.1f\n", result.num_spawned,
+		       (double)result.ai_ns / BENCH_FRAMES / 1000.0,
+		       (double)result.ai_max_ns / 1000.0,
+		       (double)result.handoffs / turns);
+	}
+
+	free(storage);
+
+	return ret;
+}
+
+/*
+ * The AI reads occupancy from bitboards rather than the tile props hash,
+ * so "tiles" (occupancy tests made by the FOV) stands in for hash lookups.
+ */
+static int bench_ai_main(void)
+{
+	static Memory memory = {0};
+	void *storage        = aligned_alloc(64, BENCH_STORAGE_SIZE);
+
+	if (!storage || !bench_setup_memory(&memory, storage, 16)) {
+		fprintf(stderr, "Failed to allocate benchmark memory\n");
+		free(storage);
+		return 1;
+	}
+
+	printf("%d maps of each kind, %d entity/player pairs per map\n",
+	       BENCH_MAPS_PER_KIND, BENCH_PAIRS_PER_MAP);
+	printf("%-6s %9s %8s %6s %9s %8s %8s %8s %8s %8s %6s %6s\n", "map",
+	       "chase us", "nodes", "path", "no path", "step us", "nodes",
+	       "fresh us", "nodes", "idle us", "tiles", "seen");
+
+	for (i32 kind = 0; kind < BENCH_MAP_COUNT; kind++) {
+		AIBenchResult result =
+			bench_run_ai(&memory, (BenchMapKind)kind);
+		double chases = result.chase_queries ? result.chase_queries : 1;
+		double steps  = result.step_queries ? result.step_queries : 1;
+		double idles  = result.idle_queries ? result.idle_queries : 1;
+		i32 reached   = result.chase_queries - result.unreachable;
+
+		printf("%-6s %9.2f %8.1f %6.1f %8.1f%% %8.2f %8.1f %8.2f "
+		       "%8.1f %8.2f %6.1f %5.1f%%\n",
+		       bench_map_names[kind],
+		       (double)result.chase_ns / chases / 1000.0,
+		       (double)result.chase_nodes / chases,
+		       (double)result.path_length / (reached ? reached : 1),
+		       100.0 * result.unreachable / chases,
+		       (double)result.step_ns / steps / 1000.0,
+		       (double)result.step_nodes / steps,
+		       (double)result.fresh_ns / steps / 1000.0,
+		       (double)result.fresh_nodes / steps,
+		       (double)result.idle_ns / idles / 1000.0,
+		       (double)result.idle_tiles / idles,
+		       100.0 * result.sightings / idles);
+	}
+
+	free(storage);
+
+	return 0;
+}
+
+/*
+ * Builds a square BMP of BENCH_BMP_SIZE pixels a side filled with random
+ * bytes in *file. 32-bit ones have a version 3 header with an alpha mask,
+ * so every pixel gets premultiplied; 24-bit ones are plain BI_RGB.
+ * Returns the file's size, or 0 if it couldn't be allocated.
+ */
+static size_t bench_build_bmp(unsigned char **file, i32 bits, u32 seed)
+{
+	i32 size          = BENCH_BMP_SIZE;
+	size_t row_stride = ((size_t)size * (size_t)bits + 31) / 32 * 4;
+	size_t offset     = bits == 32 ? sizeof(BMPHeader) : BMP_MASKS_OFFSET;
+	size_t file_size  = offset + row_stride * (size_t)size;
+	u32 random        = seed;
+	BMPHeader header  = {
+		.signature        = BMP_SIGNATURE,
+		.file_size        = (u32)file_size,
+		.image_offset     = (u32)offset,
+		.info_header_size = (u32)(offset - BMP_FILE_HEADER_SIZE),
+		.image_width      = size,
+		.image_height     = size,
+		.number_of_planes = 1,
+		.bits_per_pixel   = (u16)bits,
+		.compression_type = bits == 32 ? BMP_BITFIELDS : BMP_RGB,
+		.red_mask         = 0x00FF0000,
+		.green_mask       = 0x0000FF00,
+		.blue_mask        = 0x000000FF,
+		.alpha_mask       = 0xFF000000,
+	};
+
+	*file = (unsigned char *)malloc(file_size);
+	if (!*file)
+		return 0;
+
+	memcpy(*file, &header, offset);
+	for (size_t i = offset; i < file_size; i++) {
+		(*file)[i] = (unsigned char)bench_random(&random);
+	}
+
+	return file_size;
+}
+
+/*
+ * Times bmp_decode on large BMPs. Throughput counts the decoded pixels
+ * written, 4 bytes each. Builds without AVX2 time the scalar loop.
+ */
+static int bench_bmp_main(void)
+{
+	static const i32 bits[2]        = {32, 24};
+	static const char *bmp_names[2] = {"argb32", "rgb24"};
+	size_t pixels_size =
+		(size_t)BENCH_BMP_SIZE * (size_t)BENCH_BMP_SIZE * 4;
+	size_t max_size = sizeof(Bitmap) + pixels_size;
+	Bitmap *bmp     = (Bitmap *)malloc(max_size);
+	int ret         = 1;
+
+	if (!bmp) {
+		fprintf(stderr, "Failed to allocate benchmark memory\n");
+		return 1;
+	}
+
+#ifdef __AVX2__
+	const char *path = "AVX2";
+#else
+	const char *path = "scalar";
+#endif
+
+	printf("%dx%d pixels, %s path, %d decodes each\n", BENCH_BMP_SIZE,
+	       BENCH_BMP_SIZE, path, BENCH_BMP_RUNS);
+	printf("%-8s %10s %10s\n", "bmp", "ms", "GB/s");
+
+	for (i32 i = 0; i < 2; i++) {
+		unsigned char *file = NULL;
+		size_t file_size    = bench_build_bmp(&file, bits[i],
+						      0xB17 + (u32)i);
+
+		/* The first decode faults the destination in */
+		if (!file_size ||
+		    !bmp_decode(file, file_size, bmp, max_size)) {
+			fprintf(stderr, "Failed to decode %s\n", bmp_names[i]);
+			free(file);
+			goto cleanup;
+		}
+
+		i64 begin = bench_now_ns();
+		for (i32 run = 0; run < BENCH_BMP_RUNS; run++) {
+			bmp_decode(file, file_size, bmp, max_size);
+		}
+		i64 elapsed = bench_now_ns() - begin;
+
+		free(file);
+
+		printf("%-8s %10.2f %10.2f\n", bmp_names[i],
+		       (double)elapsed / BENCH_BMP_RUNS / 1000000.0,
+		       (double)pixels_size * BENCH_BMP_RUNS /
+			       (double)elapsed);
+	}
+
+	ret = 0;
+
+cleanup:
+	free(bmp);
+
+	return ret;
+}
+
+/*
+ * Plays back a replay recorded in the game as fast as it will go, timing
+ * each frame and checking it against the recording. Fails if the replay
+ * diverges.
+ */
+static int bench_replay_main(int argc, char *argv[])
+{
+	static ScreenState screen_state = {{0}, NULL, 0, {0}};
+	const char *file_path = argc >= 3 ? argv[2] : BENCH_REPLAY_PATH;
+	size_t region_size    = replay_region_size(file_path);
+	void *region          = NULL;
+	Replay replay         = {0};
+	Input input           = {0};
+	i64 total_ns          = 0;
+	i64 max_ns            = 0;
+	int ret               = 1;
+
+	if (!region_size) {
+		fprintf(stderr, "%s isn't a replay for this build\n",
+			file_path);
+		return 1;
+	}
+
+	region                    = aligned_alloc(4096, region_size);
+	screen_state.image_buffer = (u32 *)malloc(WIN_WIDTH * WIN_HEIGHT * 4);
+
+	if (!region || !screen_state.image_buffer) {
+		fprintf(stderr, "Failed to allocate benchmark memory\n");
+		goto cleanup;
+	}
+
+	if (!replay_start_playback(&replay, file_path, region, region_size))
+		goto cleanup;
+
+	Memory *memory = (Memory *)region;
+	game_redraw(memory, &screen_state);
+
+	while (replay_begin_frame(&replay, &input)) {
+		i64 start = bench_now_ns();
+		game_update_and_render(memory, &input, &screen_state);
+		i64 elapsed = bench_now_ns() - start;
+
+		replay_end_frame(&replay, &input, memory);
+
+		total_ns += elapsed;
+		if (elapsed > max_ns) {
+			max_ns = elapsed;
+		}
+	}
+
+	i32 num_frames = replay.num_frames;
+	ret            = replay.diverged_frame < 0 ? 0 : 1;
+	replay_stop(&replay);
+
+	printf("worker threads: %d\n", worker_pool.num_threads);
+	printf("%9s %12s %12s %12s\n", "frames", "total ms", "us/frame",
+	       "max us");
+	printf("%9d %12.1f %12.1f %12.1f\n", num_frames,
+	       (double)total_ns / 1000000.0,
+	       (double)total_ns / (num_frames ? num_frames : 1) / 1000.0,
+	       (double)max_ns / 1000.0);
+
+cleanup:
+	free(screen_state.image_buffer);
+	free(region);
+
+	return ret;
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: <string.h>, <immintrin.h> (AVX2 builds), game.h, util.c
+ */
+
+/*
+ * Bitmap decoding. A Bitmap holds premultiplied ARGB pixels with the
+ * bottom row first. Files already in that layout (NativeBitmapHeader) are
+ * copied as they are. BMPs are converted a row at a time.
+ *
+ * The BMPs taken are 24-bit BI_RGB, and 32-bit BI_RGB, BI_BITFIELDS or
+ * BI_ALPHABITFIELDS whose masks each pick out a whole byte. Rows can run
+ * either way and are padded to 4 bytes. A BMP without an alpha mask is
+ * opaque. Anything else, or a header that doesn't agree with the file's
+ * size, is rejected before a pixel is written.
+ *
+ * Premultiplying rounds c * a / 255 to nearest with integer maths. AVX2
+ * builds do eight pixels at a time with byte shuffles; the scalar loop
+ * does the rest, and everything on other builds.
+ */
+
+#define BMP_SIGNATURE 0x4D42 /* "BM" */
+#define BMP_FILE_HEADER_SIZE 14
+#define BMP_INFO_HEADER_SIZE 40
+#define BMP_MASKS_OFFSET 54 /* masks follow a 40 byte info header */
+#define BMP_RGB 0
+#define BMP_BITFIELDS 3
+#define BMP_ALPHABITFIELDS 6
+#define BMP_MAX_DIMENSION 16384
+
+/* Where a BMP's pixels are and how to read them */
+typedef struct BMPLayout {
+	const unsigned char *first_row; /* as stored in the file */
+	size_t row_stride;
+	i32 width;
+	i32 height;
+	bool top_down;
+	i32 bytes_per_pixel;
+	/* Byte of each channel within a pixel, alpha_byte is -1 if opaque */
+	i32 red_byte;
+	i32 green_byte;
+	i32 blue_byte;
+	i32 alpha_byte;
+} BMPLayout;
+
+static bool bmp__read_layout(const unsigned char *file, size_t file_size,
+			     BMPLayout *layout);
+static i32 bmp__mask_byte(u32 mask, i32 bytes_per_pixel);
+static void bmp__convert_row(const BMPLayout *layout, const unsigned char *src,
+			     u32 *dst);
+static i32 bmp__convert_pixels_avx2(const BMPLayout *layout,
+				    const unsigned char *src, u32 *dst);
+static u32 bmp__premultiply(u32 value, u32 alpha);
+
+/*
+ * Writes the bitmap in file to bmp, which has max_size bytes. Returns the
+ * size of the Bitmap, or 0 if the file is bad or doesn't fit.
+ */
+size_t bmp_decode(const unsigned char *file, size_t file_size, Bitmap *bmp,
+		  size_t max_size)
+{
+	NativeBitmapHeader native = {0};
+	BMPLayout layout          = {0};
+
+	if (file_size >= sizeof(native)) {
+		memcpy(&native, file, sizeof(native));
+	}
+
+	if (native.magic == BITMAP_NATIVE_MAGIC) {
+		if (native.version != BITMAP_NATIVE_VERSION ||
+		    native.width <= 0 || native.height <= 0 ||
+		    native.width > BMP_MAX_DIMENSION ||
+		    native.height > BMP_MAX_DIMENSION)
+			return 0;
+
+		layout.width     = native.width;
+		layout.height    = native.height;
+		layout.first_row = file + sizeof(native);
+	} else if (!bmp__read_layout(file, file_size, &layout)) {
+		return 0;
+	}
+
+	size_t num_pixels  = (size_t)layout.width * (size_t)layout.height;
+	size_t pixels_size = num_pixels * 4;
+
+	if (max_size < sizeof(Bitmap) ||
+	    pixels_size > max_size - sizeof(Bitmap))
+		return 0;
+
+	bmp->width  = layout.width;
+	bmp->height = layout.height;
+
+	if (native.magic == BITMAP_NATIVE_MAGIC) {
+		if (pixels_size > file_size - sizeof(native))
+			return 0;
+
+		memcpy(bmp->data, layout.first_row, pixels_size);
+		return pixels_size + sizeof(Bitmap);
+	}
+
+	u32 *image = (u32 *)bmp->data;
+
+	for (i32 y = 0; y < layout.height; y++) {
+		/* Bitmaps keep the bottom row first */
+		i32 row = layout.top_down ? layout.height - 1 - y : y;
+		const unsigned char *src =
+			layout.first_row + (size_t)y * layout.row_stride;
+
+		bmp__convert_row(&layout, src,
+				 image + (size_t)row * (size_t)layout.width);
+	}
+
+	return pixels_size + sizeof(Bitmap);
+}
+
+static bool bmp__read_layout(const unsigned char *file, size_t file_size,
+			     BMPLayout *layout)
+{
+	BMPHeader header = {0};
+
+	if (file_size < BMP_FILE_HEADER_SIZE + BMP_INFO_HEADER_SIZE)
+		return false;
+
+	/* Fields past the end of a short file read as 0 */
+	memcpy(&header, file,
+	       file_size < sizeof(header) ? file_size : sizeof(header));
+
+	u32 compression = header.compression_type;
+	i32 bits        = header.bits_per_pixel;
+	i32 height      = header.image_height;
+
+	if (header.signature != BMP_SIGNATURE ||
+	    header.info_header_size < BMP_INFO_HEADER_SIZE ||
+	    header.number_of_planes != 1 || header.image_width <= 0 ||
+	    header.image_width > BMP_MAX_DIMENSION || height == 0 ||
+	    height < -BMP_MAX_DIMENSION || height > BMP_MAX_DIMENSION)
+		return false;
+
+	bool has_masks = compression == BMP_BITFIELDS ||
+		compression == BMP_ALPHABITFIELDS;
+
+	if (!(bits == 24 && compression == BMP_RGB) &&
+	    !(bits == 32 && (compression == BMP_RGB || has_masks)))
+		return false;
+
+	/*
+	 * Masks sit in the info header from version 2 on, otherwise right
+	 * after it. Only version 3 headers and BI_ALPHABITFIELDS have alpha.
+	 */
+	size_t header_end = BMP_FILE_HEADER_SIZE + header.info_header_size;
+	bool has_alpha    = has_masks &&
+		(header.info_header_size >= 56 ||
+		 compression == BMP_ALPHABITFIELDS);
+
+	if (has_masks && header.info_header_size == BMP_INFO_HEADER_SIZE) {
+		header_end = BMP_MASKS_OFFSET + (has_alpha ? 16 : 12);
+	}
+
+	layout->width           = header.image_width;
+	layout->height          = height < 0 ? -height : height;
+	layout->top_down        = height < 0;
+	layout->bytes_per_pixel = bits / 8;
+	layout->row_stride =
+		((size_t)layout->width * (size_t)bits + 31) / 32 * 4;
+
+	if (has_masks) {
+		layout->red_byte   = bmp__mask_byte(header.red_mask, 4);
+		layout->green_byte = bmp__mask_byte(header.green_mask, 4);
+		layout->blue_byte  = bmp__mask_byte(header.blue_mask, 4);
+		layout->alpha_byte = has_alpha && header.alpha_mask ?
+			bmp__mask_byte(header.alpha_mask, 4) :
+			-1;
+	} else {
+		layout->red_byte   = 2;
+		layout->green_byte = 1;
+		layout->blue_byte  = 0;
+		layout->alpha_byte = -1;
+	}
+
+	if (layout->red_byte < 0 || layout->green_byte < 0 ||
+	    layout->blue_byte < 0 ||
+	    (has_alpha && header.alpha_mask && layout->alpha_byte < 0))
+		return false;
+
+	/* The last row's padding is allowed to be missing */
+	size_t offset = header.image_offset;
+	size_t pixels_size =
+		layout->row_stride * (size_t)(layout->height - 1) +
+		(size_t)layout->width * (size_t)layout->bytes_per_pixel;
+
+	if (header_end > file_size || offset < header_end ||
+	    offset > file_size || pixels_size > file_size - offset)
+		return false;
+
+	layout->first_row = file + offset;
+
+	return true;
+}
+
+/* Which byte of a pixel the mask covers, -1 if it isn't exactly one byte */
+static i32 bmp__mask_byte(u32 mask, i32 bytes_per_pixel)
+{
+	i32 shift = util_bit_scan_forward_u(mask);
+
+	if (shift < 0 || shift % 8 != 0 || shift / 8 >= bytes_per_pixel ||
+	    mask != (u32)0xFF << shift)
+		return -1;
+
+	return shift / 8;
+}
+
+static void bmp__convert_row(const BMPLayout *layout, const unsigned char *src,
+			     u32 *dst)
+{
+	i32 stride = layout->bytes_per_pixel;
+	i32 x      = bmp__convert_pixels_avx2(layout, src, dst);
+
+	for (; x < layout->width; x++) {
+		const unsigned char *pixel = src + x * stride;
+		u32 alpha                  = 255;
+
+		if (layout->alpha_byte >= 0) {
+			alpha = pixel[layout->alpha_byte];
+		}
+
+		u32 red   = bmp__premultiply(pixel[layout->red_byte], alpha);
+		u32 green = bmp__premultiply(pixel[layout->green_byte], alpha);
+		u32 blue  = bmp__premultiply(pixel[layout->blue_byte], alpha);
+
+		dst[x] = (alpha << 24) | (red << 16) | (green << 8) | blue;
+	}
+}
+
+/*
+ * Converts as much of the row as it can eight pixels at a time and returns
+ * how many pixels that was. Pixels are shuffled into BGRA byte order, which
+ * is ARGB read as a u32, then spread to 16 bits a channel to premultiply.
+ */
+static i32 bmp__convert_pixels_avx2(const BMPLayout *layout,
+				    const unsigned char *src, u32 *dst)
+{
+	i32 x = 0;
+
+#ifdef __AVX2__
+	i32 stride = layout->bytes_per_pixel;
+	char order[16];
+
+	/* Bytes with the top bit set shuffle in as 0 */
+	for (i32 i = 0; i < 4; i++) {
+		order[i * 4 + 0] = (char)(i * stride + layout->blue_byte);
+		order[i * 4 + 1] = (char)(i * stride + layout->green_byte);
+		order[i * 4 + 2] = (char)(i * stride + layout->red_byte);
+		order[i * 4 + 3] = layout->alpha_byte < 0 ?
+			(char)0x80 :
+			(char)(i * stride + layout->alpha_byte);
+	}
+
+	__m256i shuffle =
+		_mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i *)order));
+	__m256i opaque = _mm256_set1_epi32((i32)0xFF000000);
+
+	if (stride == 3) {
+		/* Each half loads 16 bytes for 12, so stop short of the end */
+		for (; x + 10 <= layout->width; x += 8) {
+			const unsigned char *pixels = src + x * 3;
+			__m128i low  = _mm_loadu_si128((const __m128i *)pixels);
+			__m128i high = _mm_loadu_si128(
+				(const __m128i *)(pixels + 12));
+			__m256i data = _mm256_inserti128_si256(
+				_mm256_castsi128_si256(low), high, 1);
+
+			data = _mm256_or_si256(
+				_mm256_shuffle_epi8(data, shuffle), opaque);
+			_mm256_storeu_si256((__m256i *)(dst + x), data);
+		}
+
+		return x;
+	}
+
+	__m256i zero     = _mm256_setzero_si256();
+	__m256i rounding = _mm256_set1_epi16(128);
+	/* Alpha is multiplied by 255 so it comes through unchanged */
+	__m256i alpha_lane =
+		_mm256_setr_epi16(0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255,
+				  0, 0, 0, 255);
+
+	for (; x + 8 <= layout->width; x += 8) {
+		__m256i data =
+			_mm256_loadu_si256((const __m256i *)(src + x * 4));
+		data = _mm256_shuffle_epi8(data, shuffle);
+
+		if (layout->alpha_byte < 0) {
+			data = _mm256_or_si256(data, opaque);
+			_mm256_storeu_si256((__m256i *)(dst + x), data);
+			continue;
+		}
+
+		/* Two pixels per lane in each half, a channel per word */
+		__m256i halves[2] = {_mm256_unpacklo_epi8(data, zero),
+				     _mm256_unpackhi_epi8(data, zero)};
+
+		for (i32 i = 0; i < 2; i++) {
+			__m256i alpha = _mm256_shufflehi_epi16(
+				_mm256_shufflelo_epi16(halves[i], 0xFF), 0xFF);
+			alpha = _mm256_or_si256(alpha, alpha_lane);
+
+			/* round(c * a / 255) = (t + (t >> 8)) >> 8 */
+			__m256i t = _mm256_add_epi16(
+				_mm256_mullo_epi16(halves[i], alpha), rounding);
+			halves[i] = _mm256_srli_epi16(
+				_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)),
+				8);
+		}
+
+		data = _mm256_packus_epi16(halves[0], halves[1]);
+		_mm256_storeu_si256((__m256i *)(dst + x), data);
+	}
+#else
+	(void)layout;
+	(void)src;
+	(void)dst;
+#endif
+
+	return x;
+}
+
+/* value * alpha / 255, rounded to nearest */
+static u32 bmp__premultiply(u32 value, u32 alpha)
+{
+	u32 t = value * alpha + 128;
+
+	return (t + (t >> 8)) >> 8;
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: game.h, memory.c, scheduler.c
+ */
+
+/*
+ * The world's entity pool. Slots are handed out from a free list, falling
+ * back to slots never used before, and each live slot sits in exactly one
+ * of its segment's per-state lists. Walking a list:
+ *
+ *	for (i32 e = list->state_head[s]; e >= 0; e = list_next[e])
+ *
+ * with list_next the pool's list_next array, see RelPtr.
+ */
+
+static bool ent__push_array(Memory *memory, RelPtr *array, size_t size);
+static void ent__link(EntityPool *pool, SegmentEntities *list, i32 slot,
+		      AIStateIndex state);
+static void ent__unlink(EntityPool *pool, SegmentEntities *list, i32 slot);
+
+/* Empties a segment's lists, for a new pool or a slot being reused */
+void ent_clear_segment(SegmentEntities *list)
+{
+	*list = (SegmentEntities){.player_pos = {-1, -1}};
+	for (i32 state = 0; state < AIST_COUNT; state++) {
+		list->state_head[state] = -1;
+	}
+}
+
+/*
+ * Reserves room for capacity entities, the pool of path buffers they share
+ * and the store for evicted segments' entities from the level arena, and
+ * empties every map segment's lists.
+ * Returns false if the arena is too small.
+ */
+bool ent_create_pool(EntityPool *pool, Memory *memory, i32 capacity)
+{
+	size_t count = (size_t)capacity;
+
+	*pool = (EntityPool){.capacity = capacity, .free_list = -1};
+
+	if (capacity <= 0 || capacity > ENTITY_INDEX_MASK)
+		return false;
+
+	if (!ent__push_array(memory, &pool->generation, count * sizeof(u16)) ||
+	    !ent__push_array(memory, &pool->segment, count * sizeof(i32)) ||
+	    !ent__push_array(memory, &pool->list_next, count * sizeof(i32)) ||
+	    !ent__push_array(memory, &pool->list_prev, count * sizeof(i32)) ||
+	    !ent__push_array(memory, &pool->position, count * sizeof(Vec2)) ||
+	    !ent__push_array(memory, &pool->ai_state,
+			     count * sizeof(AIStateIndex)) ||
+	    !ent__push_array(memory, &pool->next_turn, count * sizeof(u32)) ||
+	    !ent__push_array(memory, &pool->turn_index, count * sizeof(i32)) ||
+	    !ent__push_array(memory, &pool->speed, count * sizeof(i32)) ||
+	    !ent__push_array(memory, &pool->face_direction,
+			     count * sizeof(Direction)) ||
+	    !ent__push_array(memory, &pool->path_cache,
+			     count * sizeof(PathCache)) ||
+	    !ent__push_array(memory, &pool->fov,
+			     count * sizeof(FieldOfView)) ||
+	    !ent__push_array(memory, &pool->stored,
+			     count * sizeof(StoredEntity)) ||
+	    !mem_create_pool(&pool->paths, &memory->level_arena,
+			     MEM_TAG_PATHS, sizeof(PathBuffer),
+			     MAX_PATH_BUFFERS)) {
+		pool->capacity = 0;
+		return false;
+	}
+
+	MapSegment *map_segments = memory->world_state.map_segments;
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		ent_clear_segment(&map_segments[i].entities);
+	}
+
+	return true;
+}
+
+/*
+ * Takes a slot and links it into the segment's list for the given state.
+ * Only the pool's bookkeeping is set up; the caller fills in the rest of
+ * the entity. Returns the slot, or -1 if the pool is full.
+ */
+i32 ent_alloc(EntityPool *pool, MapSegment *map_segment, AIStateIndex state)
+{
+	u16 *generation = (u16 *)mem_rel_get(&pool->generation);
+	i32 *list_next  = (i32 *)mem_rel_get(&pool->list_next);
+	i32 *segment    = (i32 *)mem_rel_get(&pool->segment);
+	i32 *turn_index = (i32 *)mem_rel_get(&pool->turn_index);
+	PathCache *path_cache =
+		(PathCache *)mem_rel_get(&pool->path_cache);
+	i32 slot;
+
+	if (pool->free_list >= 0) {
+		slot            = pool->free_list;
+		pool->free_list = list_next[slot];
+	} else if (pool->num_slots < pool->capacity) {
+		slot             = pool->num_slots++;
+		generation[slot] = 1;
+	} else {
+		return -1;
+	}
+
+	segment[slot]    = map_segment->index;
+	turn_index[slot] = -1;
+	path_cache[slot] = (PathCache){.planner = -1, .path = -1};
+	pool->num_live++;
+	map_segment->entities.num_entities++;
+	ent__link(pool, &map_segment->entities, slot, state);
+
+	return slot;
+}
+
+/* Returns NULL if the entity has no path buffer */
+PathBuffer *ent_get_path(EntityPool *pool, i32 slot)
+{
+	PathCache *path_cache =
+		&((PathCache *)mem_rel_get(&pool->path_cache))[slot];
+
+	return (PathBuffer *)mem_pool_at(&pool->paths, path_cache->path);
+}
+
+/*
+ * Gives the entity a path buffer unless it has one. Returns its buffer, or
+ * NULL if the pool's buffers are all in use.
+ */
+PathBuffer *ent_alloc_path(EntityPool *pool, i32 slot)
+{
+	PathCache *path_cache =
+		&((PathCache *)mem_rel_get(&pool->path_cache))[slot];
+
+	if (path_cache->path < 0) {
+		path_cache->path = mem_pool_index(&pool->paths,
+						  mem_pool_alloc(&pool->paths));
+	}
+
+	return ent_get_path(pool, slot);
+}
+
+/* Hands the entity's path buffer back, if it has one */
+void ent_free_path(EntityPool *pool, i32 slot)
+{
+	PathCache *path_cache =
+		&((PathCache *)mem_rel_get(&pool->path_cache))[slot];
+
+	mem_pool_free(&pool->paths, ent_get_path(pool, slot));
+	path_cache->path = -1;
+}
+
+/*
+ * Unlinks the slot and puts it on the free list, staling its handles. Its
+ * path buffer goes back to the pool. A planner it held goes once it's the
+ * least recently used, see plan_acquire.
+ */
+void ent_free(EntityPool *pool, MapSegment *map_segment, i32 slot)
+{
+	u16 *generation = (u16 *)mem_rel_get(&pool->generation);
+	i32 *list_next  = (i32 *)mem_rel_get(&pool->list_next);
+	i32 *segment    = (i32 *)mem_rel_get(&pool->segment);
+
+	ent_free_path(pool, slot);
+	sched_remove(pool, &map_segment->entities.turns, slot);
+	ent__unlink(pool, &map_segment->entities, slot);
+	map_segment->entities.num_entities--;
+	pool->num_live--;
+
+	segment[slot]   = -1;
+	list_next[slot] = pool->free_list;
+	pool->free_list = slot;
+
+	/* Generations skip 0 so no handle is ever 0 */
+	if (++generation[slot] == 0) {
+		generation[slot] = 1;
+	}
+}
+
+EntityHandle ent_handle(EntityPool *pool, i32 slot)
+{
+	u16 *generation = (u16 *)mem_rel_get(&pool->generation);
+
+	return ((EntityHandle)generation[slot] << ENTITY_GENERATION_SHIFT) |
+		(EntityHandle)slot;
+}
+
+/* Returns the handle's slot, or -1 if its entity no longer exists */
+i32 ent_slot(EntityPool *pool, EntityHandle handle)
+{
+	u16 *generations = (u16 *)mem_rel_get(&pool->generation);
+	i32 *segment     = (i32 *)mem_rel_get(&pool->segment);
+	i32 slot         = (i32)(handle & ENTITY_INDEX_MASK);
+	u16 generation   = (u16)(handle >> ENTITY_GENERATION_SHIFT);
+
+	if (slot >= pool->num_slots || segment[slot] < 0 ||
+	    generations[slot] != generation)
+		return -1;
+
+	return slot;
+}
+
+/* Moves the entity to the list for new_state */
+void ent_set_state(EntityPool *pool, SegmentEntities *list, i32 slot,
+		   AIStateIndex new_state)
+{
+	AIStateIndex *ai_state = (AIStateIndex *)mem_rel_get(&pool->ai_state);
+
+	if (ai_state[slot] == new_state)
+		return;
+
+	ent__unlink(pool, list, slot);
+	ent__link(pool, list, slot, new_state);
+}
+
+static void ent__link(EntityPool *pool, SegmentEntities *list, i32 slot,
+		      AIStateIndex state)
+{
+	i32 *list_next         = (i32 *)mem_rel_get(&pool->list_next);
+	i32 *list_prev         = (i32 *)mem_rel_get(&pool->list_prev);
+	AIStateIndex *ai_state = (AIStateIndex *)mem_rel_get(&pool->ai_state);
+	i32 head               = list->state_head[state];
+
+	list_prev[slot] = -1;
+	list_next[slot] = head;
+	if (head >= 0) {
+		list_prev[head] = slot;
+	}
+
+	list->state_head[state] = slot;
+	list->state_count[state]++;
+	ai_state[slot] = state;
+}
+
+static void ent__unlink(EntityPool *pool, SegmentEntities *list, i32 slot)
+{
+	i32 *list_next         = (i32 *)mem_rel_get(&pool->list_next);
+	i32 *list_prev         = (i32 *)mem_rel_get(&pool->list_prev);
+	AIStateIndex *ai_state = (AIStateIndex *)mem_rel_get(&pool->ai_state);
+	AIStateIndex state     = ai_state[slot];
+	i32 next               = list_next[slot];
+	i32 prev               = list_prev[slot];
+
+	if (prev >= 0) {
+		list_next[prev] = next;
+	} else {
+		list->state_head[state] = next;
+	}
+
+	if (next >= 0) {
+		list_prev[next] = prev;
+	}
+
+	list->state_count[state]--;
+}
+
+static bool ent__push_array(Memory *memory, RelPtr *array, size_t size)
+{
+	void *pushed = mem_push_level(memory, size, MEM_TAG_ENTITIES);
+
+	mem_rel_set(array, pushed);
+
+	return pushed != NULL;
+}
@@ -0,0 +1,228 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: game.h, occupancy.c
+ */
+
+/*
+ * Symmetric recursive shadowcasting. The area around the origin is split into
+ * four quadrants, each scanned row by row moving away from the origin. Slopes
+ * are kept as fractions so everything stays in integer maths. See
+ * https://www.albertford.com/shadowcasting/ for a description.
+ */
+
+typedef struct FovRow {
+	i32 depth;
+	i32 start_num;
+	i32 start_den;
+	i32 end_num;
+	i32 end_den;
+} FovRow;
+
+typedef struct FovScan {
+	FieldOfView *fov;
+	MapSegment *map_segment;
+	Vec2 origin;
+	Direction quadrant;
+	i32 tiles_tested;
+} FovScan;
+
+static void fov__scan(FovScan *scan, FovRow row);
+static Vec2 fov__transform(FovScan *scan, i32 depth, i32 column);
+static i32 fov__floor_div(i32 a, i32 b);
+static void fov__reveal(FieldOfView *fov, Vec2 tile);
+
+/* Returns how many tiles had to be tested for opacity */
+i32 fov_compute(FieldOfView *fov, MapSegment *map_segment, Vec2 origin,
+		Direction facing)
+{
+	memset(fov->rows, 0, sizeof(fov->rows));
+	fov->origin = origin;
+	fov->facing = facing;
+	fov->dirty  = false;
+
+	fov__reveal(fov, origin);
+
+	FovScan scan = {
+		.fov         = fov,
+		.map_segment = map_segment,
+		.origin      = origin,
+	};
+
+	/* Skip the quadrant directly behind the entity */
+	Direction behind = NULLDIR;
+	switch (facing) {
+	case UPDIR:
+		behind = DOWNDIR;
+		break;
+	case RIGHTDIR:
+		behind = LEFTDIR;
+		break;
+	case DOWNDIR:
+		behind = UPDIR;
+		break;
+	case LEFTDIR:
+		behind = RIGHTDIR;
+		break;
+	default:
+		break;
+	}
+
+	for (Direction quadrant = UPDIR; quadrant <= LEFTDIR; quadrant++) {
+		if (quadrant == behind)
+			continue;
+
+		FovRow first_row = {.depth     = 1,
+				    .start_num = -1,
+				    .start_den = 1,
+				    .end_num   = 1,
+				    .end_den   = 1};
+		scan.quadrant    = quadrant;
+		fov__scan(&scan, first_row);
+	}
+
+	/*
+	 * The side quadrants reach slightly behind the entity, so cut the
+	 * result down to the half of the segment it's facing
+	 */
+	for (i32 y = 0; y < SCREEN_HEIGHT_TILES; y++) {
+		switch (facing) {
+		case UPDIR:
+			if (y > origin.y)
+				fov->rows[y] = 0;
+			break;
+		case DOWNDIR:
+			if (y < origin.y)
+				fov->rows[y] = 0;
+			break;
+		case RIGHTDIR:
+			fov->rows[y] &= ~(((u64)1 << origin.x) - 1);
+			break;
+		case LEFTDIR:
+			fov->rows[y] &= ((u64)1 << (origin.x + 1)) - 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	return scan.tiles_tested;
+}
+
+bool fov_is_visible(FieldOfView *fov, i32 x, i32 y)
+{
+	if (x < 0 || x >= SCREEN_WIDTH_TILES || y < 0 ||
+	    y >= SCREEN_HEIGHT_TILES)
+		return false;
+
+	return !!(fov->rows[y] & ((u64)1 << x));
+}
+
+static void fov__scan(FovScan *scan, FovRow row)
+{
+	if (row.depth > FOV_RADIUS)
+		return;
+
+	i32 depth = row.depth;
+
+	/* Columns covered by this row, rounding ties towards the centre */
+	i32 min_column = fov__floor_div(2 * depth * row.start_num + row.start_den,
+				       2 * row.start_den);
+	i32 max_column = -fov__floor_div(-(2 * depth * row.end_num - row.end_den),
+					 2 * row.end_den);
+
+	/* -1: no previous tile, 0: previous was floor, 1: previous was wall */
+	i32 previous = -1;
+
+	for (i32 column = min_column; column <= max_column; column++) {
+		Vec2 tile    = fov__transform(scan, depth, column);
+		bool is_wall = occ_is_opaque(scan->map_segment, tile.x, tile.y);
+		scan->tiles_tested++;
+		bool is_symmetric = column * row.start_den >=
+				depth * row.start_num &&
+			column * row.end_den <= depth * row.end_num;
+
+		if (is_wall || is_symmetric) {
+			fov__reveal(scan->fov, tile);
+		}
+
+		if (previous == 1 && !is_wall) {
+			row.start_num = 2 * column - 1;
+			row.start_den = 2 * depth;
+		}
+
+		if (previous == 0 && is_wall) {
+			FovRow next_row = row;
+			next_row.depth++;
+			next_row.end_num = 2 * column - 1;
+			next_row.end_den = 2 * depth;
+			fov__scan(scan, next_row);
+		}
+
+		previous = is_wall ? 1 : 0;
+	}
+
+	if (previous == 0) {
+		row.depth++;
+		fov__scan(scan, row);
+	}
+}
+
+static Vec2 fov__transform(FovScan *scan, i32 depth, i32 column)
+{
+	Vec2 origin = scan->origin;
+	Vec2 out    = origin;
+
+	switch (scan->quadrant) {
+	case UPDIR:
+		out.x = origin.x + column;
+		out.y = origin.y - depth;
+		break;
+	case RIGHTDIR:
+		out.x = origin.x + depth;
+		out.y = origin.y + column;
+		break;
+	case DOWNDIR:
+		out.x = origin.x + column;
+		out.y = origin.y + depth;
+		break;
+	case LEFTDIR:
+		out.x = origin.x - depth;
+		out.y = origin.y + column;
+		break;
+	default:
+		break;
+	}
+
+	return out;
+}
+
+/* Division rounding towards negative infinity, b must be positive */
+static i32 fov__floor_div(i32 a, i32 b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static void fov__reveal(FieldOfView *fov, Vec2 tile)
+{
+	if (tile.x < 0 || tile.x >= SCREEN_WIDTH_TILES || tile.y < 0 ||
+	    tile.y >= SCREEN_HEIGHT_TILES)
+		return;
+
+	fov->rows[tile.y] |= (u64)1 << tile.x;
+}
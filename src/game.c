@@ -17,15 +17,14 @@
 
 /*
  * Dependendencies: <string.h>, game.h, , util.c, memory.c tile_map.c,
- * hashmap.c
+ * world.c, bitmap.c
  */
 
 static const i32 SCREEN_HEIGHT_PIXELS = SCREEN_HEIGHT_TILES * TILE_HEIGHT;
 static const i32 SCREEN_WIDTH_PIXELS  = SCREEN_WIDTH_TILES * TILE_WIDTH;
 
 static void check_and_prep_screen_transition(WorldState *world_state,
-					     PlayerState *player_state,
-					     MapSegment *map_segments);
+					     PlayerState *player_state);
 static void display_bitmap_tile(u32 *image_buffer, Bitmap *bmp, i32 tile_number,
 				i32 target_x, i32 target_y, i32 tile_width,
 				i32 tile_height, bool mirrored);
@@ -34,12 +33,16 @@ static size_t load_bitmap(const char file_path[], void *load_location,
 			  size_t max_size);
 static void move_player(WorldState *world_state, PlayerState *player_state,
 			ScreenState *screen_state);
-static void move_entities(Entities *entities, ScreenState *screen_state);
+static bool init_world_systems(Memory *memory, i32 entity_capacity);
+static bool reset_level(Memory *memory, i32 entity_capacity);
+static i32 load_level(Memory *memory, const char file_path[]);
+static void move_entities(WorldState *world_state, ScreenState *screen_state);
+static void simulate_entities(Memory *memory);
 static void handle_player_collision(WorldState *world_state,
 				    PlayerState *player_state, Input *input,
 				    ScreenState *screen_state);
 static void hot_tile_push(ScreenState *screen_state, u32 tile_x, u32 tile_y);
-static void render_entities(u32 *image_buffer, MapSegment *map_segment);
+static void render_entities(u32 *image_buffer, WorldState *world_state);
 static void render_hot_tiles(ScreenState *screen_state,
 			     WorldState *world_state);
 static void render_player(u32 *image_buffer, PlayerState *player_state);
@@ -53,44 +56,64 @@ static void scroll_screens(u32 *image_buffer, PlayerState *player_state,
 static void warp_to_screen(u32 *image_buffer, PlayerState *player_state,
 			   WorldState *world_state);
 
-void game_initialize_memory(Memory *memory, ScreenState *screen_state, i32 dt)
+/* Returns false if the arenas can't hold the world's runtime structures */
+bool game_initialize_memory(Memory *memory, ScreenState *screen_state, i32 dt)
 {
 	PlayerState *player_state = &memory->player_state;
 	WorldState *world_state   = &memory->world_state;
-	load_bitmap("resources/player_sprites.bmp",
-		    (void *)player_state->player_sprites,
-		    MAX_PLAYER_SPRITE_SIZE);
+	Arena *permanent_arena    = &memory->permanent_arena;
 
-	world_state->tile_set = mem_load_file_to_temp_storage(
-		memory, "resources/tile_set.bmp", &load_bitmap, false);
+	if (!init_world_systems(memory, MAX_ENTITIES))
+		return false;
 
-	world_state->tile_props =
-		hash_create_hash_int(memory, mem_reserve_temp_storage);
+	/*
+	 * The bitmaps load in the background while the map is read. The tile
+	 * set goes at the end of the permanent arena, so nothing else is
+	 * pushed there until it's in.
+	 */
+	i32 sprites_load = platform_request_asset_load(
+		"resources/player_sprites.bmp",
+		(void *)player_state->player_sprites, MAX_PLAYER_SPRITE_SIZE,
+		&load_bitmap);
+
+	size_t tile_set_max_size = 0;
+	void *tile_set = mem_begin_load(permanent_arena, &tile_set_max_size);
+	i32 tile_set_load = -1;
+	if (tile_set) {
+		tile_set_load = platform_request_asset_load(
+			"resources/tile_set.bmp", tile_set, tile_set_max_size,
+			&load_bitmap);
+	}
 
-	i32 tile_map_rc =
-		tm_load_tile_map("resources/maps/test_tilemap.tm", memory);
+	/* The binary map loads faster; the text one is there as a fallback */
+	i32 tile_map_rc = load_level(memory, "resources/maps/test_tilemap.tmb");
+	if (tile_map_rc != 0) {
+		tile_map_rc = load_level(memory,
+					 "resources/maps/test_tilemap.tm");
+	}
 
+	MapSegment *first_segment = NULL;
 	if (tile_map_rc == 0) {
-		world_state->current_map_segment = &memory->map_segments[0];
+		first_segment = world_require_segment(world_state, 0);
+	}
+
+	if (first_segment) {
+		world_state->current_map_segment = 0;
 		Vec2 test_entity_position        = {.x = 10, .y = 5};
 
-		Entities *entities =
-			&world_state->current_map_segment->entities;
-		entities->data[entities->num_entities].position =
-			test_entity_position;
-		entities->data[entities->num_entities].id =
-			entities->num_entities + 1;
-		entities->data[entities->num_entities++].face_direction =
-			RIGHTDIR;
-
-		u32 key = util_compactify_three_u32(
-			0, (u32)test_entity_position.x,
-			(u32)test_entity_position.y);
-		u64 value = (u64)1 << 32;
-
-		hash_insert_int(&world_state->tile_props, key, value);
+		ai_spawn_entity(world_state, first_segment,
+				test_entity_position, RIGHTDIR,
+				AIST_ENEMY_IDLE);
 	}
 
+	/* The first frame draws both, so they're waited on here */
+	(void)platform_wait_asset_load(sprites_load);
+
+	size_t tile_set_size = platform_wait_asset_load(tile_set_load);
+	mem_rel_set(&world_state->tile_set,
+		    mem_finish_load(permanent_arena, tile_set, tile_set_size,
+				    false, MEM_TAG_TILE_SET));
+
 	player_state->tile_x = 15;
 	player_state->tile_y = 3;
 	player_state->pixel_x =
@@ -104,8 +127,11 @@ void game_initialize_memory(Memory *memory, ScreenState *screen_state, i32 dt)
 	world_state->turn_duration = 8 * (16 / dt);
 
 	render_map_segment(screen_state->image_buffer,
-			   world_state->current_map_segment,
-			   world_state->tile_set, 0, 0);
+			   world_get_segment(world_state,
+					     world_state->current_map_segment),
+			   mem_rel_get(&world_state->tile_set), 0, 0);
+
+	return true;
 }
 
 void game_update_and_render(Memory *memory, Input *input,
@@ -115,6 +141,11 @@ void game_update_and_render(Memory *memory, Input *input,
 	WorldState *world_state   = &memory->world_state;
 	u32 *image_buffer         = screen_state->image_buffer;
 
+	mem_reset_arena(&memory->frame_arena);
+
+	world_update(world_state, (Vec2){.x = player_state->tile_x,
+					 .y = player_state->tile_y});
+
 	if (world_state->trans_state == TRANS_STATE_SCROLLING) {
 		scroll_screens(image_buffer, player_state, world_state);
 		return;
@@ -126,8 +157,7 @@ void game_update_and_render(Memory *memory, Input *input,
 	}
 
 	if (player_state->move_counter <= 0) {
-		check_and_prep_screen_transition(world_state, player_state,
-						 memory->map_segments);
+		check_and_prep_screen_transition(world_state, player_state);
 
 		if (world_state->trans_state != TRANS_STATE_NORMAL &&
 		    world_state->trans_state != TRANS_STATE_WAITING)
@@ -137,75 +167,165 @@ void game_update_and_render(Memory *memory, Input *input,
 					screen_state);
 
 	} else {
-		Entities *entities =
-			&world_state->current_map_segment->entities;
-		ai_run_ai_system(entities, world_state, player_state);
-		move_entities(entities, screen_state);
+		simulate_entities(memory);
+		move_entities(world_state, screen_state);
 		move_player(world_state, player_state, screen_state);
 	}
 
 	render_hot_tiles(screen_state, world_state);
 
-	render_entities(image_buffer, world_state->current_map_segment);
+	render_entities(image_buffer, world_state);
 
 	render_player(image_buffer, player_state);
 
 	render_status_bar(image_buffer);
 }
 
+/*
+ * Paints the whole screen again, for when it no longer shows what's in
+ * memory, like after a save state is loaded
+ */
+void game_redraw(Memory *memory, ScreenState *screen_state)
+{
+	WorldState *world_state = &memory->world_state;
+	u32 *image_buffer       = screen_state->image_buffer;
+
+	screen_state->hot_tiles_length = 0;
+	memset(screen_state->hot_tile_rows, 0,
+	       sizeof(screen_state->hot_tile_rows));
+
+	render_map_segment(image_buffer,
+			   world_get_segment(world_state,
+					     world_state->current_map_segment),
+			   mem_rel_get(&world_state->tile_set), 0, 0);
+
+	render_entities(image_buffer, world_state);
+
+	render_player(image_buffer, &memory->player_state);
+
+	render_status_bar(image_buffer);
+}
+
+/*
+ * Splits temp storage into arenas and sets up the world's runtime structures
+ * around an empty level. Kept apart from asset loading so a headless build
+ * can set up a world of its own.
+ */
+static bool init_world_systems(Memory *memory, i32 entity_capacity)
+{
+	WorldState *world_state = &memory->world_state;
+
+	if (!mem_init_arenas(memory))
+		return false;
+
+	world_state->plan_expansions_per_frame = PLAN_EXPANSIONS_PER_FRAME;
+
+	return reset_level(memory, entity_capacity);
+}
+
+/*
+ * Empties the level arena and sets up a world with no map segments or
+ * entities in it, with room for entity_capacity entities. Each of them
+ * can have a planner of its own, up to MAX_PLANNERS.
+ */
+static bool reset_level(Memory *memory, i32 entity_capacity)
+{
+	WorldState *world_state = &memory->world_state;
+	i32 num_planners =
+		entity_capacity < MAX_PLANNERS ? entity_capacity : MAX_PLANNERS;
+
+	mem_reset_arena(&memory->level_arena);
+	world_clear(world_state);
+	memset(world_state->is_full_detail, 0,
+	       sizeof(world_state->is_full_detail));
+	world_state->current_map_segment = -1;
+	world_state->next_map_segment    = -1;
+	world_state->lod                 = (LodState){0};
+
+	Planner *planners = (Planner *)mem_push_level(
+		memory, (size_t)num_planners * sizeof(Planner),
+		MEM_TAG_PLANNERS);
+	mem_rel_set(&world_state->planners, planners);
+	world_state->num_planners = planners ? num_planners : 0;
+
+	for (i32 i = 0; i < world_state->num_planners; i++) {
+		planners[i].owner       = 0;
+		planners[i].initialized = false;
+	}
+
+	return planners && ent_create_pool(&world_state->entities, memory,
+					   entity_capacity);
+}
+
+/* Replaces the current level with the map in the file */
+static i32 load_level(Memory *memory, const char file_path[])
+{
+	if (!reset_level(memory, MAX_ENTITIES))
+		return -1;
+
+	return tm_load_tile_map(file_path, memory);
+}
+
 static void check_and_prep_screen_transition(WorldState *world_state,
-					     PlayerState *player_state,
-					     MapSegment *map_segments)
+					     PlayerState *player_state)
 {
-	MapSegment *old_map_segment = world_state->current_map_segment;
-	i32 tile_x                  = player_state->tile_x;
-	i32 tile_y                  = player_state->tile_y;
-	i32 segment_index           = old_map_segment->index;
+	MapSegment *old_map_segment =
+		world_get_segment(world_state,
+				  world_state->current_map_segment);
+	i32 tile_x = player_state->tile_x;
+	i32 tile_y = player_state->tile_y;
 
-	if (tile_y == -1 && old_map_segment->top_connection) {
+	if (tile_y == -1 && old_map_segment->top_connection >= 0) {
 		world_state->trans_state          = TRANS_STATE_SCROLLING;
 		world_state->transition_counter   = SCREEN_HEIGHT_PIXELS;
 		world_state->transition_direction = UPDIR;
 		world_state->next_map_segment = old_map_segment->top_connection;
 	} else if (tile_y == SCREEN_HEIGHT_TILES &&
-		   old_map_segment->bottom_connection) {
+		   old_map_segment->bottom_connection >= 0) {
 		world_state->trans_state          = TRANS_STATE_SCROLLING;
 		world_state->transition_counter   = SCREEN_HEIGHT_PIXELS;
 		world_state->transition_direction = DOWNDIR;
 		world_state->next_map_segment =
 			old_map_segment->bottom_connection;
-	} else if (tile_x == -1 && old_map_segment->left_connection) {
+	} else if (tile_x == -1 && old_map_segment->left_connection >= 0) {
 		world_state->trans_state          = TRANS_STATE_SCROLLING;
 		world_state->transition_counter   = SCREEN_WIDTH_PIXELS;
 		world_state->transition_direction = LEFTDIR;
 		world_state->next_map_segment =
 			old_map_segment->left_connection;
 	} else if (tile_x == SCREEN_WIDTH_TILES &&
-		   old_map_segment->right_connection) {
+		   old_map_segment->right_connection >= 0) {
 		world_state->trans_state          = TRANS_STATE_SCROLLING;
 		world_state->transition_counter   = SCREEN_WIDTH_PIXELS;
 		world_state->transition_direction = RIGHTDIR;
 		world_state->next_map_segment =
 			old_map_segment->right_connection;
 	} else {
-		i32 tile_x             = player_state->tile_x;
-		i32 tile_y             = player_state->tile_y;
-		IntHashMap *tile_props = &world_state->tile_props;
-		u32 key = util_compactify_three_u32((u32)segment_index,
-						    (u32)tile_x, (u32)tile_y);
-		u64 current_tile_props = hash_get_int(tile_props, key);
+		u32 current_tile_props =
+			world_tile_props(old_map_segment, tile_x, tile_y);
 
 		bool is_warp_tile = !!(current_tile_props & TPROP_IS_WARP_TILE);
 		u32 warp_map      = (current_tile_props & TPROP_WARP_MAP) >>
 			TPROP_WARP_MAP_SHIFT;
 
-		if (is_warp_tile && warp_map < MAX_MAP_SEGMENTS &&
+		if (is_warp_tile && (i32)warp_map < world_state->num_segments &&
 		    world_state->trans_state != TRANS_STATE_WAITING) {
 
 			world_state->trans_state      = TRANS_STATE_WARPING;
-			world_state->next_map_segment = &map_segments[warp_map];
+			world_state->next_map_segment = (i32)warp_map;
 		}
 	}
+
+	/* The screen can't move until the segment it's moving to is in */
+	bool is_moving = world_state->trans_state == TRANS_STATE_SCROLLING ||
+		world_state->trans_state == TRANS_STATE_WARPING;
+
+	i32 next = world_state->next_map_segment;
+
+	if (is_moving && !world_require_segment(world_state, next)) {
+		world_state->trans_state      = TRANS_STATE_NORMAL;
+		world_state->next_map_segment = -1;
+	}
 }
 
 static void display_bitmap_tile(u32 *restrict image_buffer,
@@ -310,8 +430,9 @@ static void handle_player_collision(WorldState *world_state,
 				    PlayerState *player_state, Input *input,
 				    ScreenState *screen_state)
 {
-	i32 segment_index      = world_state->current_map_segment->index;
-	IntHashMap *tile_props = &world_state->tile_props;
+	MapSegment *current_map_segment =
+		world_get_segment(world_state,
+				  world_state->current_map_segment);
 
 	u32 keys = input->keys;
 
@@ -325,16 +446,15 @@ static void handle_player_collision(WorldState *world_state,
 		player_state->move_direction = is_up ? UPDIR : DOWNDIR;
 
 		bool is_not_colliding = true;
-		u32 key = util_compactify_three_u32((u32)segment_index & 0xFFFF,
-						    (u32)tile_x & 0xFF,
-						    (u32)new_tile_y & 0xFF);
-		u64 current_tile_props = hash_get_int(tile_props, key);
+		u32 current_tile_props = world_tile_props(current_map_segment,
+							  tile_x, new_tile_y);
 
 		if (new_tile_y >= 0 && new_tile_y < SCREEN_HEIGHT_TILES &&
 		    tile_x >= 0 && tile_x < SCREEN_WIDTH_TILES) {
 			is_not_colliding =
 				!(current_tile_props & TPROP_HAS_COLLISION) &&
-				!(current_tile_props & TPROP_ENTITY);
+				!occ_entity_at(current_map_segment, tile_x,
+					       new_tile_y);
 		}
 
 		if (is_not_colliding) {
@@ -356,16 +476,15 @@ static void handle_player_collision(WorldState *world_state,
 		player_state->move_direction = is_right ? RIGHTDIR : LEFTDIR;
 
 		bool is_not_colliding = true;
-		u32 key = util_compactify_three_u32((u32)segment_index & 0xFFFF,
-						    (u32)new_tile_x & 0xFF,
-						    (u32)tile_y & 0xFF);
-		u64 current_tile_props = hash_get_int(tile_props, key);
+		u32 current_tile_props = world_tile_props(current_map_segment,
+							  new_tile_x, tile_y);
 
 		if (new_tile_x >= 0 && new_tile_x < SCREEN_WIDTH_TILES &&
 		    tile_y >= 0 && tile_y < SCREEN_HEIGHT_TILES) {
 			is_not_colliding =
 				!(current_tile_props & TPROP_HAS_COLLISION) &&
-				!(current_tile_props & TPROP_ENTITY);
+				!occ_entity_at(current_map_segment, new_tile_x,
+					       tile_y);
 		}
 
 		if (is_not_colliding) {
@@ -386,85 +505,36 @@ static void hot_tile_push(ScreenState *screen_state, u32 tile_x, u32 tile_y)
 	    tile_y >= SCREEN_HEIGHT_TILES)
 		return;
 
+	/*
+	 * hot_tiles has room for every tile once, but a screen full of
+	 * chasers pushes each tile up to four times, so repeats are dropped
+	 */
+	u64 tile_bit = (u64)1 << tile_x;
+	if (screen_state->hot_tile_rows[tile_y] & tile_bit)
+		return;
+
+	screen_state->hot_tile_rows[tile_y] |= tile_bit;
+
 	u32 value = ((tile_x & 0xFFFF) << 16) | (tile_y & 0xFFFF);
 
 	screen_state->hot_tiles[screen_state->hot_tiles_length++] = value;
 }
 
+/* Decodes straight out of the mapped file, see bitmap.c */
 static size_t load_bitmap(const char file_path[], void *load_location,
 			  size_t max_size)
 {
-	size_t result = debug_platform_load_asset(
-		file_path, (void *)load_location, max_size);
+	AssetView view = platform_map_asset(file_path);
 
-	if (!result) {
+	if (!view.data)
 		return 0;
-	}
-
-	BMPHeader *header = (BMPHeader *)load_location;
-
-	u32 image_offset = header->image_offset;
-	i32 image_width  = header->image_width;
-	i32 image_height = header->image_height;
-
-	u32 red_mask   = header->red_mask;
-	u32 green_mask = header->green_mask;
-	u32 blue_mask  = header->blue_mask;
-	u32 alpha_mask = header->alpha_mask;
 
-	/* Discard header and copy image data to location */
-	unsigned char *image_data = ((unsigned char *)header) + image_offset;
-	Bitmap *bmp               = (Bitmap *)load_location;
-	bmp->width                = image_width;
-	bmp->height               = image_height;
+	size_t result = bmp_decode((const unsigned char *)view.data, view.size,
+				   (Bitmap *)load_location, max_size);
 
-	memcpy(bmp->data, image_data, (size_t)(image_width * image_height * 4));
+	platform_unmap_asset(view);
 
-	/*
-	 * For swizzling:
-	 * How many bits we need to shift to get values to start at bit 0
-	 */
-	u32 red_shift   = (u32)util_bit_scan_forward_u(red_mask);
-	u32 green_shift = (u32)util_bit_scan_forward_u(green_mask);
-	u32 blue_shift  = (u32)util_bit_scan_forward_u(blue_mask);
-	u32 alpha_shift = (u32)util_bit_scan_forward_u(alpha_mask);
-
-	red_shift   = red_shift < 0 ? 0 : red_shift;
-	green_shift = green_shift < 0 ? 0 : green_shift;
-	blue_shift  = blue_shift < 0 ? 0 : blue_shift;
-	alpha_shift = alpha_shift < 0 ? 0 : alpha_shift;
-
-	u32 *image = (u32 *)bmp->data;
-
-	for (i32 i = 0; i < image_width * image_height; i++) {
-		u32 color = image[i];
-
-		/* Pre-multiply alpha */
-		u32 alpha     = (((color & alpha_mask) >> alpha_shift) & 0xFF);
-		float opacity = alpha / 255.0f;
-
-		u32 red       = (((color & red_mask) >> red_shift) & 0xFF);
-		u32 green     = (((color & green_mask) >> green_shift) & 0xFF);
-		u32 blue      = (((color & blue_mask) >> blue_shift) & 0xFF);
-		float new_red = opacity * (float)red;
-		float new_green = opacity * (float)green;
-		float new_blue  = opacity * (float)blue;
-		red             = (u32)new_red;
-		green           = (u32)new_green;
-		blue            = (u32)new_blue;
-
-		/* Swizzle color values to ensure ARGB order */
-		alpha = alpha << 24;
-		red   = red << 16;
-		green = green << 8;
-
-		image[i] = alpha | red | green | blue;
-	}
-
-	size_t bitmap_size =
-		(size_t)(image_width * image_height * 4) + sizeof(Bitmap);
-
-	return bitmap_size;
+	return result;
 }
 
 static void move_player(WorldState *world_state, PlayerState *player_state,
@@ -511,45 +581,131 @@ static void move_player(WorldState *world_state, PlayerState *player_state,
 }
 
 /*
- * TODO: need a better method of determining which tiles are hot / make
- * sure we don't push the same tiles to the hot list more than once
- * */
-static void move_entities(Entities *entities, ScreenState *screen_state)
+ * The current segment and the ones connected to it run full AI, with the
+ * player's position translated into each neighbour's coordinates. The rest
+ * of the world runs the cheap low-detail simulation.
+ */
+static void simulate_entities(Memory *memory)
 {
-	for (i32 i = 0; i < entities->num_entities; i++) {
-		Entity *ent = &entities->data[i];
-		if (ent->current_ai_state == AIST_ENEMY_CHASE) {
-			hot_tile_push(screen_state, (u32)ent->position.x,
-				      (u32)(ent->position.y - 1));
-			hot_tile_push(screen_state, (u32)ent->position.x,
-				      (u32)(ent->position.y + 1));
-			hot_tile_push(screen_state, (u32)(ent->position.x - 1),
-				      (u32)ent->position.y);
-			hot_tile_push(screen_state, (u32)(ent->position.x + 1),
-				      (u32)ent->position.y);
+	WorldState *world_state   = &memory->world_state;
+	PlayerState *player_state = &memory->player_state;
+	MapSegment *current =
+		world_get_segment(world_state,
+				  world_state->current_map_segment);
+	Vec2 player_pos = {.x = player_state->tile_x, .y = player_state->tile_y};
+
+	MapSegment *segments[5] = {
+		current,
+		world_get_segment(world_state, current->top_connection),
+		world_get_segment(world_state, current->right_connection),
+		world_get_segment(world_state, current->bottom_connection),
+		world_get_segment(world_state, current->left_connection),
+	};
+	Vec2 offsets[5] = {
+		{0, 0},
+		{0, SCREEN_HEIGHT_TILES},
+		{-SCREEN_WIDTH_TILES, 0},
+		{0, -SCREEN_HEIGHT_TILES},
+		{SCREEN_WIDTH_TILES, 0},
+	};
+
+	world_state->frame_clock++;
+	world_state->plan_budget = world_state->plan_expansions_per_frame;
+
+	bool is_full_detail[MAX_RESIDENT_SEGMENTS] = {0};
+	for (i32 i = 0; i < 5; i++) {
+		if (segments[i]) {
+			is_full_detail[segments[i]->index] = true;
+		}
+	}
+
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		if (is_full_detail[i] != world_state->is_full_detail[i]) {
+			ai_set_segment_detail(&world_state->map_segments[i],
+					      world_state, is_full_detail[i]);
+			world_state->is_full_detail[i] = is_full_detail[i];
 		}
 	}
+
+	for (i32 i = 0; i < 5; i++) {
+		MapSegment *map_segment = segments[i];
+
+		/* Skip missing and repeated connections */
+		bool seen = !map_segment;
+		for (i32 j = 0; j < i && !seen; j++) {
+			seen = segments[j] == map_segment;
+		}
+
+		if (seen)
+			continue;
+
+		Vec2 segment_player_pos = {.x = player_pos.x + offsets[i].x,
+					   .y = player_pos.y + offsets[i].y};
+		ai_run_ai_system(map_segment, world_state, segment_player_pos,
+				 &memory->frame_arena);
+	}
+
+	ai_run_lod_system(world_state->map_segments,
+			  world_state->is_full_detail, world_state);
 }
 
-static void render_entities(u32 *image_buffer, MapSegment *map_segment)
+/*
+ * TODO: need a better method of determining which tiles are hot
+ * */
+static void move_entities(WorldState *world_state, ScreenState *screen_state)
 {
-	Entities *entities = &map_segment->entities;
-	i32 num_entities   = entities->num_entities;
-
-	for (i32 i = 0; i < num_entities; i++) {
-		i32 tile_x  = entities->data[i].position.x;
-		i32 tile_y  = entities->data[i].position.y;
-		i32 pixel_x = util_convert_tile_to_pixel(tile_x, X_DIMENSION);
-		i32 pixel_y = util_convert_tile_to_pixel(tile_y, Y_DIMENSION);
+	EntityPool *entities  = &world_state->entities;
+	SegmentEntities *list = &world_get_segment(
+		world_state, world_state->current_map_segment)->entities;
+	i32 *list_next  = (i32 *)mem_rel_get(&entities->list_next);
+	Vec2 *positions = (Vec2 *)mem_rel_get(&entities->position);
+
+	for (i32 entity = list->state_head[AIST_ENEMY_CHASE]; entity >= 0;
+	     entity = list_next[entity]) {
+		Vec2 position = positions[entity];
+		hot_tile_push(screen_state, (u32)position.x,
+			      (u32)(position.y - 1));
+		hot_tile_push(screen_state, (u32)position.x,
+			      (u32)(position.y + 1));
+		hot_tile_push(screen_state, (u32)(position.x - 1),
+			      (u32)position.y);
+		hot_tile_push(screen_state, (u32)(position.x + 1),
+			      (u32)position.y);
+	}
+}
 
-		render_rectangle(image_buffer, pixel_x - 16, pixel_x + 16,
-				 pixel_y - 16, pixel_y + 16, 0.0f, 1.0f, 1.0f);
+static void render_entities(u32 *image_buffer, WorldState *world_state)
+{
+	EntityPool *entities  = &world_state->entities;
+	SegmentEntities *list = &world_get_segment(
+		world_state, world_state->current_map_segment)->entities;
+	i32 *list_next  = (i32 *)mem_rel_get(&entities->list_next);
+	Vec2 *positions = (Vec2 *)mem_rel_get(&entities->position);
+
+	for (i32 state = 0; state < AIST_COUNT; state++) {
+		for (i32 entity = list->state_head[state]; entity >= 0;
+		     entity = list_next[entity]) {
+			i32 tile_x  = positions[entity].x;
+			i32 tile_y  = positions[entity].y;
+			i32 pixel_x =
+				util_convert_tile_to_pixel(tile_x, X_DIMENSION);
+			i32 pixel_y =
+				util_convert_tile_to_pixel(tile_y, Y_DIMENSION);
+
+			render_rectangle(image_buffer, pixel_x - 16,
+					 pixel_x + 16, pixel_y - 16,
+					 pixel_y + 16, 0.0f, 1.0f, 1.0f);
+		}
 	}
 }
 
 static void render_hot_tiles(ScreenState *screen_state, WorldState *world_state)
 {
-	u32 *tiles           = (u32 *)world_state->current_map_segment->tiles;
+	MapSegment *map_segment =
+		world_get_segment(world_state,
+				  world_state->current_map_segment);
+	Bitmap *tile_set     = (Bitmap *)mem_rel_get(&world_state->tile_set);
+	u32 *tiles           = (u32 *)map_segment->tiles;
 	u32 *hot_tiles       = screen_state->hot_tiles;
 	i32 hot_tiles_length = screen_state->hot_tiles_length;
 	u32 *image_buffer    = screen_state->image_buffer;
@@ -570,12 +726,11 @@ static void render_hot_tiles(ScreenState *screen_state, WorldState *world_state)
 			(tile_data & TM_BG_TILE) >> TM_BG_TILE_SHIFT;
 		u32 fg_tile_number = tile_data & TM_FG_TILE;
 
-		display_bitmap_tile(image_buffer, world_state->tile_set,
-				    (i32)bg_tile_number, (i32)target_x,
-				    (i32)target_y, TILE_WIDTH, TILE_HEIGHT,
-				    false);
+		display_bitmap_tile(image_buffer, tile_set, (i32)bg_tile_number,
+				    (i32)target_x, (i32)target_y, TILE_WIDTH,
+				    TILE_HEIGHT, false);
 		if (fg_tile_number) {
-			display_bitmap_tile(image_buffer, world_state->tile_set,
+			display_bitmap_tile(image_buffer, tile_set,
 					    (i32)fg_tile_number, (i32)target_x,
 					    (i32)target_y, TILE_WIDTH,
 					    TILE_HEIGHT, false);
@@ -583,6 +738,8 @@ static void render_hot_tiles(ScreenState *screen_state, WorldState *world_state)
 	}
 
 	screen_state->hot_tiles_length = 0;
+	memset(screen_state->hot_tile_rows, 0,
+	       sizeof(screen_state->hot_tile_rows));
 }
 
 static void render_player(u32 *image_buffer, PlayerState *player_state)
@@ -746,13 +903,17 @@ static void scroll_screens(u32 *image_buffer, PlayerState *player_state,
 		break;
 	}
 
-	render_map_segment(image_buffer, world_state->next_map_segment,
-			   world_state->tile_set, new_map_x_offset,
-			   new_map_y_offset);
+	render_map_segment(image_buffer,
+			   world_get_segment(world_state,
+					     world_state->next_map_segment),
+			   mem_rel_get(&world_state->tile_set),
+			   new_map_x_offset, new_map_y_offset);
 
-	render_map_segment(image_buffer, world_state->current_map_segment,
-			   world_state->tile_set, old_map_x_offset,
-			   old_map_y_offset);
+	render_map_segment(image_buffer,
+			   world_get_segment(world_state,
+					     world_state->current_map_segment),
+			   mem_rel_get(&world_state->tile_set),
+			   old_map_x_offset, old_map_y_offset);
 
 	render_player(image_buffer, player_state);
 
@@ -762,14 +923,12 @@ static void scroll_screens(u32 *image_buffer, PlayerState *player_state,
 static void warp_to_screen(u32 *image_buffer, PlayerState *player_state,
 			   WorldState *world_state)
 {
-	i32 segment_index      = world_state->current_map_segment->index;
-	i32 tile_x             = player_state->tile_x;
-	i32 tile_y             = player_state->tile_y;
-	IntHashMap *tile_props = &world_state->tile_props;
-	u32 key                = util_compactify_three_u32(
-                (u32)segment_index, (u32)tile_x & 0xFF, (u32)tile_y & 0xFF);
-
-	u64 current_tile_props = hash_get_int(tile_props, key);
+	MapSegment *map_segment =
+		world_get_segment(world_state,
+				  world_state->current_map_segment);
+	u32 current_tile_props = world_tile_props(
+		map_segment, player_state->tile_x, player_state->tile_y);
+
 	player_state->tile_x =
 		(current_tile_props & TPROP_WTILE_X) >> TPROP_WTILE_X_SHIFT;
 	player_state->tile_y =
@@ -779,14 +938,16 @@ static void warp_to_screen(u32 *image_buffer, PlayerState *player_state,
 	player_state->pixel_x =
 		util_convert_tile_to_pixel(player_state->tile_x, X_DIMENSION);
 
-	render_map_segment(image_buffer, world_state->next_map_segment,
-			   world_state->tile_set, 0, 0);
+	render_map_segment(image_buffer,
+			   world_get_segment(world_state,
+					     world_state->next_map_segment),
+			   mem_rel_get(&world_state->tile_set), 0, 0);
 
 	render_player(image_buffer, player_state);
 
 	render_status_bar(image_buffer);
 
 	world_state->current_map_segment = world_state->next_map_segment;
-	world_state->next_map_segment    = NULL;
+	world_state->next_map_segment    = -1;
 	world_state->trans_state         = TRANS_STATE_WAITING;
 }
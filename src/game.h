@@ -16,7 +16,7 @@
  */
 
 /*
- * Dependencies: <stdint.h>, <stdbool.h>, hashmap.c
+ * Dependencies: <stdint.h>, <stdbool.h>
  */
 
 #define WIN_X 10
@@ -28,15 +28,40 @@
 #define TILE_HEIGHT 32
 #define SCREEN_WIDTH_TILES 40
 #define SCREEN_HEIGHT_TILES 20
-#define MAX_MAP_SEGMENTS 64
+#define MAX_RESIDENT_SEGMENTS 64
+#define WORLD_PATH_LENGTH 64
+#define WORLD_PREFETCH_DISTANCE 4
+#define WORLD_LOAD_FRAMES 16
 #define SAMPLES_PER_SECOND 44100
 #define BYTES_PER_SAMPLE 4
 #define TARGET_FRAME_RATE 60
 #define MAX_PLAYER_SPRITE_SIZE 100 * 1024
-#define MAX_SEGMENT_ENTITIES 50
-#define MAX_PATH_LENGTH 5
+#define MAX_ENTITIES 1024
+#define FOV_RADIUS 16
+#define OCC_NUM_TILES (SCREEN_WIDTH_TILES * SCREEN_HEIGHT_TILES)
+#define OCC_QUERY_BATCH 64
+#define MAX_PLANNERS 64
+#define PLAN_NUM_CELLS (SCREEN_WIDTH_TILES * SCREEN_HEIGHT_TILES)
+#define PLAN_INFINITY 0xFFFF
+#define LOD_TURNS_PER_PASS 4
+#define LOD_MAX_ENTITIES_PER_FRAME 256
+#define PLAN_EXPANSIONS_PER_FRAME 2048
+#define PLAN_EXPANSIONS_PER_SLICE 256
+#define ARENA_ALIGNMENT 64
+#define PERMANENT_ARENA_SIZE (1024 * 1024)
+#define FRAME_ARENA_SIZE (256 * 1024)
+#define MAX_PATH_BUFFERS 256
 
-struct Memory;
+#define ARENA_NAME_LENGTH 16
+
+/*
+ * Game state holds no pointers, so it can be saved and loaded as plain
+ * bytes. Where it would, it holds a RelPtr: the distance from the RelPtr
+ * itself to its target, which stays right wherever the memory holding both
+ * is mapped. 0 stands for NULL. See mem_rel_get and mem_rel_set. A struct
+ * holding one has to be set up where it lives, never copied there.
+ */
+typedef i64 RelPtr;
 
 #pragma pack(push, 1)
 typedef struct {
@@ -69,6 +94,20 @@ typedef struct {
 	char data[];
 } Bitmap;
 
+/*
+ * A bitmap file already laid out like Bitmap: this header, then width *
+ * height premultiplied ARGB pixels, bottom row first as in a BMP
+ */
+#define BITMAP_NATIVE_MAGIC 0x4D424455 /* "UDBM" */
+#define BITMAP_NATIVE_VERSION 1
+
+typedef struct NativeBitmapHeader {
+	u32 magic;
+	u32 version;
+	i32 width;
+	i32 height;
+} NativeBitmapHeader;
+
 typedef enum { X_DIMENSION, Y_DIMENSION } CoordDimension;
 
 typedef enum { NULLDIR, UPDIR, RIGHTDIR, DOWNDIR, LEFTDIR } Direction;
@@ -105,39 +144,170 @@ typedef struct Vec2 {
 typedef enum {
 	AIST_ENEMY_IDLE,
 	AIST_ENEMY_CHASE,
+	AIST_COUNT
 } AIStateIndex;
 
-typedef struct PathCache {
-	Vec2 data[MAX_PATH_LENGTH];
+/*
+ * A finished path, as tile indices. Sized for the longest path a segment
+ * has room for, so none is ever cut short.
+ */
+typedef struct PathBuffer {
 	i32 length;
+	u16 cells[PLAN_NUM_CELLS];
+} PathBuffer;
+
+/*
+ * Searches run in the entity's planner, see planner.c, and each one that
+ * finishes is copied to the entity's path buffer. next is the index of the
+ * next step to take, so an entity can keep walking its last path while a
+ * new search is still running, or after its planner is taken.
+ */
+typedef struct PathCache {
+	i32 planner;
+	i32 path; /* index in the world's path buffer pool, -1 if none */
+	i32 next;
 } PathCache;
 
-typedef struct Entity {
-	i32 id;
+/* Bit x of row y is set when tile (x, y) is visible */
+typedef struct FieldOfView {
+	u64 rows[SCREEN_HEIGHT_TILES];
+	Vec2 origin;
+	Direction facing;
+	bool dirty;
+} FieldOfView;
+
+/*
+ * Handles name an entity slot and the generation it was spawned in, so a
+ * handle kept past the entity's despawn can be told apart from whatever
+ * reuses the slot. 0 is never a valid handle.
+ */
+typedef u32 EntityHandle;
+#define ENTITY_INDEX_MASK 0xFFFF
+#define ENTITY_GENERATION_SHIFT 16
+#define ENTITY_NORMAL_SPEED 100
+
+/* What an allocation is for, see memory.c */
+typedef enum {
+	MEM_TAG_TILE_SET,
+	MEM_TAG_MAP,
+	MEM_TAG_ENTITIES,
+	MEM_TAG_PLANNERS,
+	MEM_TAG_PATHS,
+	MEM_TAG_AI_SCRATCH,
+	MEM_TAG_AUDIO,
+	MEM_TAG_BENCH,
+	MEM_TAG_COUNT
+} MemTag;
+
+/* Fixed-size blocks taken and given back in any order, see memory.c */
+typedef struct Pool {
+	MemTag tag; /* names the pool in reports */
+	RelPtr base;
+	size_t item_size;
+	size_t stride; /* item_size rounded up to a cache line */
+	i32 capacity;
+	i32 num_fresh; /* blocks never handed out start here */
+	i32 free_list; /* -1 if empty */
+	i32 num_used;
+	i32 high_water;
+	i32 num_failures; /* allocations made while the pool was full */
+} Pool;
+
+/* An entity of a segment that was evicted, see ai_store_segment */
+typedef struct StoredEntity {
+	i32 segment_id;
 	Vec2 position;
-	AIStateIndex current_ai_state;
-	AIStateIndex idle_ai_state;
-	i32 ai_counter;
-	i32 move_counter;
-	i32 path_counter;
 	Direction face_direction;
-	PathCache path_cache;
-} Entity;
+	AIStateIndex ai_state;
+	i32 speed;
+} StoredEntity;
 
-typedef struct Entities {
+/*
+ * Every entity in the world, stored as parallel arrays indexed by slot and
+ * reserved from temp storage. The entities of each map segment are linked
+ * into one list per AI state through list_next and list_prev. The arrays'
+ * element types are noted by each.
+ */
+typedef struct EntityPool {
+	i32 capacity;
+	i32 num_slots; /* slots handed out so far, live or freed */
+	i32 num_live;
+	i32 free_list; /* -1 if empty */
+	RelPtr generation; /* u16 */
+	RelPtr segment; /* i32, index in map_segments, -1 if the slot is free */
+	RelPtr list_next; /* i32 */
+	RelPtr list_prev; /* i32 */
+	RelPtr position; /* Vec2 */
+	RelPtr ai_state; /* AIStateIndex */
+	RelPtr next_turn; /* u32, frame the entity acts on, see scheduler.c */
+	/* i32, place in its segment's turn queue, -1 if none */
+	RelPtr turn_index;
+	/* i32, ENTITY_NORMAL_SPEED acts once a turn, twice that twice */
+	RelPtr speed;
+	RelPtr face_direction; /* Direction */
+	RelPtr path_cache; /* PathCache */
+	RelPtr fov; /* FieldOfView */
+	Pool paths; /* PathBuffer, see ent_alloc_path */
+	/* StoredEntity, room for capacity of them */
+	RelPtr stored;
+	i32 num_stored;
+} EntityPool;
+
+/* Entities waiting to act, see scheduler.c */
+typedef struct TurnQueue {
+	i32 count;
+	i32 slots[PLAN_NUM_CELLS];
+} TurnQueue;
+
+/* A map segment's share of the pool, see entity.c */
+typedef struct SegmentEntities {
 	i32 num_entities;
-	Entity data[MAX_SEGMENT_ENTITIES];
-} Entities;
+	i32 state_count[AIST_COUNT];
+	i32 state_head[AIST_COUNT]; /* first slot in each state, -1 if none */
+	TurnQueue turns;
+	Vec2 player_pos; /* where the player was on the last AI run */
+} SegmentEntities;
 
+/*
+ * Bit x of row y is set when tile (x, y) is occupied. entity_at holds the
+ * handle of the entity on each tile, 0 if there's none, and always agrees
+ * with the entities bitboard.
+ */
+typedef struct Occupancy {
+	u64 collision[SCREEN_HEIGHT_TILES];
+	u64 entities[SCREEN_HEIGHT_TILES];
+	EntityHandle entity_at[SCREEN_HEIGHT_TILES][SCREEN_WIDTH_TILES];
+} Occupancy;
+
+/* What a slot in map_segments holds, see world.c */
+typedef enum {
+	SEGMENT_EMPTY = 0,
+	SEGMENT_LOADING,
+	SEGMENT_RESIDENT
+} SegmentState;
+
+/*
+ * One segment of the world, resident in a slot of map_segments. Segments
+ * are known by their id, their place in the world file, and connections
+ * are the ids of the neighbouring segments, -1 if none. The connections
+ * through the occupancy are filled in by the segment's loader.
+ */
 typedef struct MapSegment {
-	i32 index;
-	struct MapSegment *top_connection;
-	struct MapSegment *right_connection;
-	struct MapSegment *bottom_connection;
-	struct MapSegment *left_connection;
+	i32 index; /* slot in map_segments */
+	i32 id; /* -1 if the slot is empty */
+	SegmentState state;
+	u32 last_used; /* world_clock when last needed, for eviction */
+	i32 load; /* platform load handle while loading, -1 if none */
+	u32 load_due; /* world_clock the load is taken in on */
+	i32 top_connection;
+	i32 right_connection;
+	i32 bottom_connection;
+	i32 left_connection;
 	/* Format for tiles: (bg_tile_num << 16) | fg_tile_num */
 	u32 tiles[SCREEN_HEIGHT_TILES][SCREEN_WIDTH_TILES];
-	Entities entities;
+	u32 props[SCREEN_HEIGHT_TILES][SCREEN_WIDTH_TILES]; /* TPROP_ flags */
+	Occupancy occupancy;
+	SegmentEntities entities;
 } MapSegment;
 
 typedef enum {
@@ -147,35 +317,99 @@ typedef enum {
 	TRANS_STATE_WARPING
 } TransitionState;
 
-typedef struct IntPair {
-	u32 key;
-	u64 value;
-} IntPair;
-
-typedef struct IntHashMap {
-	u32 filled_cells;
-	u32 length;
-	IntPair *data;
-	struct Memory *memory;
-	void *(*alloc_func)(struct Memory *, size_t);
-} IntHashMap;
-
-typedef struct AStarNode {
-	i32 g_cost;
-	i32 h_cost;
-	Vec2 parent;
-	Vec2 position;
-} AStarNode;
+typedef struct PlanKey {
+	i32 primary;
+	i32 secondary;
+} PlanKey;
+
+/*
+ * Search state for one chasing entity. Cells are tile indices
+ * (y * SCREEN_WIDTH_TILES + x) within the planner's map segment.
+ */
+typedef struct Planner {
+	EntityHandle owner; /* 0 if free */
+	u32 last_used;
+	bool initialized;
+	bool search_done; /* false while a search is cut off part way */
+	i32 segment_index;
+	Vec2 start;
+	Vec2 goal;
+	i32 key_modifier;
+	u64 blocked[SCREEN_HEIGHT_TILES];
+	u16 g[PLAN_NUM_CELLS];
+	u16 rhs[PLAN_NUM_CELLS];
+	i16 parent[PLAN_NUM_CELLS]; /* the neighbour rhs came from, or -1 */
+	i16 heap_index[PLAN_NUM_CELLS];
+	i32 heap_length;
+	u16 heap_cells[PLAN_NUM_CELLS];
+	PlanKey heap_keys[PLAN_NUM_CELLS];
+	i32 path_length;
+	u16 path[PLAN_NUM_CELLS];
+} Planner;
+
+typedef struct MemTagStats {
+	size_t bytes; /* in use now */
+	size_t peak_bytes;
+	i32 num_live;
+	i32 num_pushed; /* ever */
+} MemTagStats;
+
+/*
+ * Written just before each push, so popping it can be taken off its tag's
+ * stats
+ */
+typedef struct ArenaRecord {
+	size_t start; /* where the arena was before the push */
+	size_t size;
+	size_t prev; /* the previous push's last_push */
+	MemTag tag;
+} ArenaRecord;
+
+/* Memory handed out in stack order, see memory.c */
+typedef struct Arena {
+	char name[ARENA_NAME_LENGTH]; /* for reports */
+	RelPtr base;
+	size_t size;
+	size_t used;
+	size_t high_water; /* the most ever in use at once */
+	MemTagStats tags[MEM_TAG_COUNT];
+	/* Offset of the newest push, its record just before it; 0 if none */
+	size_t last_push;
+} Arena;
+
+typedef size_t ArenaMark;
+
+/* Progress through the current low-detail simulation pass, see ai.c */
+typedef struct LodState {
+	u32 pass;
+	i32 frames_until_pass;
+	i32 next_slot;
+} LodState;
 
 typedef struct {
-	MapSegment *current_map_segment;
-	MapSegment *next_map_segment;
-	void *tile_set;
+	MapSegment map_segments[MAX_RESIDENT_SEGMENTS];
+	/* The world file segments are paged in from, empty if there's none */
+	char world_path[WORLD_PATH_LENGTH];
+	i32 num_segments; /* in the world; ids are below this */
+	u32 world_clock; /* counts world_update calls */
+	i32 current_map_segment; /* id, -1 if none */
+	i32 next_map_segment; /* id, -1 if none */
+	RelPtr tile_set;
 	TransitionState trans_state;
 	Direction transition_direction;
 	i32 transition_counter;
 	i32 turn_duration;
-	IntHashMap tile_props;
+	u32 frame_clock; /* frames simulated, what next_turn counts in */
+	EntityPool entities;
+	RelPtr planners; /* Planner */
+	i32 num_planners;
+	u32 planner_clock;
+	/* Cell expansions all chase searches may spend per frame, see ai.c */
+	i32 plan_expansions_per_frame;
+	i32 plan_budget; /* what's left of it this frame */
+	/* The current segment and its neighbours get full AI */
+	bool is_full_detail[MAX_RESIDENT_SEGMENTS]; /* by slot */
+	LodState lod;
 } WorldState;
 
 /* Hot tile masks */
@@ -191,8 +425,6 @@ typedef struct {
 /* Tile property masks */
 #define TPROP_HAS_COLLISION 0x01
 #define TPROP_IS_WARP_TILE 0x02
-#define TPROP_ENTITY 0xFF00000000
-#define TPROP_ENTITY_SHIFT 32
 #define TPROP_WARP_MAP 0xFF000000
 #define TPROP_WARP_MAP_SHIFT 24
 #define TPROP_WTILE_X 0xFF0000
@@ -200,13 +432,52 @@ typedef struct {
 #define TPROP_WTILE_Y 0xFF00
 #define TPROP_WTILE_Y_SHIFT 8
 
+/*
+ * Binary tile maps, see tile_map.c. Offsets count from the start of the
+ * file and are multiples of 8.
+ */
+#define TM_BINARY_MAGIC 0x4D544455 /* "UDTM" */
+#define TM_BINARY_VERSION 1
+
+typedef struct TileMapHeader {
+	u32 magic;
+	u32 version;
+	u32 segment_width; /* in tiles, must be SCREEN_WIDTH_TILES */
+	u32 segment_height; /* must be SCREEN_HEIGHT_TILES */
+	u32 num_segments;
+	u32 segments_offset; /* num_segments TileMapSegments */
+} TileMapHeader;
+
+typedef struct TileMapSegment {
+	i32 top_connection; /* -1 if none */
+	i32 right_connection;
+	i32 bottom_connection;
+	i32 left_connection;
+	u32 tiles_offset; /* laid out like MapSegment's tiles */
+	u32 collision_offset; /* laid out like Occupancy's collision */
+	u32 props_offset; /* num_props TileMapProps */
+	u32 num_props;
+} TileMapSegment;
+
+/* The properties of one tile, only written for tiles that have some */
+typedef struct TileMapProp {
+	u16 x;
+	u16 y;
+	u32 value;
+} TileMapProp;
+
+/*
+ * Everything the game keeps between frames, pointer free (see RelPtr), so a
+ * save state is this struct and its temp storage copied as they are
+ */
 typedef struct Memory {
 	PlayerState player_state;
 	WorldState world_state;
-	MapSegment map_segments[MAX_MAP_SEGMENTS];
-	void *temp_storage;
+	RelPtr temp_storage;
 	size_t temp_storage_size;
-	size_t temp_next_load_offset;
+	Arena permanent_arena;
+	Arena level_arena; /* emptied when a map is loaded */
+	Arena frame_arena; /* emptied at the start of every frame */
 	bool is_initialized;
 } Memory;
 
@@ -215,6 +486,8 @@ typedef struct {
 	u32 hot_tiles[SCREEN_HEIGHT_TILES * SCREEN_WIDTH_TILES];
 	u32 *image_buffer;
 	i32 hot_tiles_length;
+	/* Bit x of row y is set once tile (x, y) is in hot_tiles */
+	u64 hot_tile_rows[SCREEN_HEIGHT_TILES];
 } ScreenState;
 
 typedef struct {
@@ -223,13 +496,82 @@ typedef struct {
 	bool playing;
 } Sound;
 
+/*
+ * A whole file mapped read-only by the platform, or an asset in the mapped
+ * asset pack. data is NULL if there's nothing there. Nothing in Memory may
+ * point into one, since save states have to carry everything they use.
+ */
+typedef struct AssetView {
+	const void *data;
+	size_t size;
+} AssetView;
+
 typedef struct {
 	FILE *fd;
+	AssetView view; /* used instead of fd for sounds in the asset pack */
+	size_t position;
 } FileStream;
 
-void game_initialize_memory(Memory *memory, ScreenState *screen_state, i32 dt);
+/*
+ * The asset pack, see asset_pack.c. Entries are named by the path the asset
+ * would have as a loose file.
+ */
+#define ASSET_PACK_MAGIC 0x50414455 /* "UDAP" */
+#define ASSET_PACK_VERSION 1
+#define ASSET_PACK_ALIGNMENT 64
+#define ASSET_NAME_LENGTH 56
+
+typedef struct AssetPackHeader {
+	u32 magic;
+	u32 version;
+	u32 num_entries;
+	u32 entries_offset;
+} AssetPackHeader;
+
+typedef struct AssetPackEntry {
+	char name[ASSET_NAME_LENGTH]; /* NUL terminated */
+	u32 offset;
+	u32 size;
+} AssetPackEntry;
+
+/*
+ * Where a load asked for with platform_request_asset_load is up to. The
+ * platform runs loads on I/O threads, so they can go on while frames do.
+ */
+typedef enum {
+	ASSET_LOAD_PENDING,
+	ASSET_LOAD_DONE,
+	ASSET_LOAD_FAILED
+} AssetLoadState;
+
+/* Leads a save state or replay, ahead of the game's memory, see replay.c */
+typedef struct SaveStateHeader {
+	u32 magic;
+	u32 version;
+	u64 memory_size;
+	u64 region_size;
+} SaveStateHeader;
+
+typedef enum { REPLAY_OFF = 0, REPLAY_RECORDING, REPLAY_PLAYING } ReplayMode;
+
+/* The input one frame got and a checksum of the state it left behind */
+typedef struct ReplayFrame {
+	u32 keys;
+	u32 checksum;
+} ReplayFrame;
+
+typedef struct Replay {
+	ReplayMode mode;
+	FILE *file;
+	i32 num_frames; /* recorded or played so far */
+	i32 diverged_frame; /* first frame that didn't match, -1 if none */
+	u32 checksum; /* what the frame being played should leave */
+} Replay;
+
+bool game_initialize_memory(Memory *memory, ScreenState *screen_state, i32 dt);
 void game_update_and_render(Memory *memory, Input *input,
 			    ScreenState *screen_state);
+void game_redraw(Memory *memory, ScreenState *screen_state);
 
 /*
  * These are defined by platform layer.
@@ -238,3 +580,22 @@ i32 debug_platform_stream_audio(const char file_path[], FileStream *stream,
 				void *sound_buffer, i32 sound_buffer_size);
 size_t debug_platform_load_asset(const char file_path[], void *memory_location,
 				 size_t max_size);
+AssetView platform_map_asset(const char file_path[]);
+void platform_unmap_asset(AssetView view);
+/*
+ * Runs func(file_path, memory_location, max_size) in the background, or
+ * debug_platform_load_asset if func is NULL. Returns a handle, or -1 if too
+ * many loads are outstanding. Nothing else may touch memory_location until
+ * the load is done. Polling or waiting on a finished load gives its size and
+ * frees the handle; waiting returns 0 if the load failed.
+ */
+i32 platform_request_asset_load(const char file_path[], void *memory_location,
+				size_t max_size,
+				size_t (*func)(const char[], void *, size_t));
+AssetLoadState platform_poll_asset_load(i32 handle, size_t *loaded_size);
+size_t platform_wait_asset_load(i32 handle);
+/*
+ * Calls func(data, i) for every i in [0, count), spread across worker
+ * threads. Returns once all calls are done. Calls may run in any order.
+ */
+void platform_parallel_for(void (*func)(void *, i32), void *data, i32 count);
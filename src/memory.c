@@ -19,62 +19,495 @@
  * Dependencies: game.h
  */
 
-static size_t mem__get_next_aligned_offset(size_t start_offset,
-					   size_t min_to_add, size_t alignment);
+/*
+ * All of the game's memory is the one block the platform hands over as temp
+ * storage, split into three arenas by lifetime:
+ *
+ *	permanent	assets and systems that last the whole run
+ *	level		the loaded map and everything on it, reset per map
+ *	frame		scratch, emptied at the start of every frame
+ *
+ * Within an arena memory is handed out and taken back in stack order: take
+ * a mark, push what's needed, pop back to the mark when done. Every push
+ * starts on a cache line. Each arena remembers the most it has ever had in
+ * use, so the block can be sized from measurements, and a push that doesn't
+ * fit prints a report naming the arena and how full it is before returning
+ * NULL.
+ *
+ * Every push is tagged with what it's for. Arenas keep per-tag counts of
+ * the bytes and allocations live now and the most bytes ever live. Each
+ * push has a small record written in the padding just before it, linked to
+ * the one before, so popping can walk back and take each push off its tag
+ * again. The records cost no more than the padding they sit in, and the
+ * number of pushes is only limited by the arena's size. The counts can be
+ * read at any time with mem_tag_stats, or written out with the arenas'
+ * totals by mem_write_usage.
+ *
+ * Objects that come and go in no particular order, like path buffers, live
+ * in pools instead: a fixed number of same-sized blocks pushed from an
+ * arena once, each starting on a cache line. Free blocks are chained
+ * through their first bytes, so taking or giving back a block is O(1).
+ * Blocks are only threaded onto the free list once they've been used, so
+ * making a pool costs nothing however large it is. Building with
+ * DEBUG_POOLS fills free blocks with POOL_POISON and checks the fill is
+ * intact when a block is handed out again, catching writes through stale
+ * pointers.
+ */
+
+#define POOL_POISON 0xDD
+
+static const char *mem_tag_names[MEM_TAG_COUNT] = {
+	"tile_set", "map",        "entities", "planners",
+	"paths",    "ai_scratch", "audio",    "bench",
+};
+
+static void mem__carve_arena(Memory *memory, Arena *arena, const char *name,
+			     size_t *offset, size_t size);
+static size_t mem__padding(Arena *arena);
+static ArenaRecord *mem__record(Arena *arena, size_t push);
+static void mem__report_failure(Arena *arena, size_t size, MemTag tag);
+static unsigned char *mem__pool_block(Pool *pool, i32 index);
+static i32 *mem__pool_link(Pool *pool, i32 index);
+static void mem__check_poison(Pool *pool, i32 index);
+
+void *mem_rel_get(RelPtr *field)
+{
+	if (!*field)
+		return NULL;
+
+	return (void *)((uintptr_t)field + (uintptr_t)*field);
+}
+
+/* field and target must be in the same block of memory for this to last */
+void mem_rel_set(RelPtr *field, void *target)
+{
+	*field = target ? (RelPtr)((uintptr_t)target - (uintptr_t)field) : 0;
+}
+
+/*
+ * Splits temp storage into the three arenas, the level arena taking
+ * whatever the other two leave. Returns false if temp storage is too small.
+ */
+bool mem_init_arenas(Memory *memory)
+{
+	size_t offset = 0;
+	size_t fixed  = PERMANENT_ARENA_SIZE + FRAME_ARENA_SIZE;
+
+	if (!memory->temp_storage || memory->temp_storage_size <= fixed) {
+		fprintf(stderr,
+			"memory: %zu bytes of temp storage can't hold the "
+			"%zu bytes of fixed arenas\n",
+			memory->temp_storage_size, fixed);
+		return false;
+	}
+
+	mem__carve_arena(memory, &memory->permanent_arena, "permanent",
+			 &offset, PERMANENT_ARENA_SIZE);
+	mem__carve_arena(memory, &memory->frame_arena, "frame", &offset,
+			 FRAME_ARENA_SIZE);
+	mem__carve_arena(memory, &memory->level_arena, "level", &offset,
+			 memory->temp_storage_size - offset);
+
+	return true;
+}
+
+/* Returns NULL if the arena doesn't have size bytes left */
+void *mem_arena_push(Arena *arena, size_t size, MemTag tag)
+{
+	unsigned char *base = (unsigned char *)mem_rel_get(&arena->base);
+	size_t padding      = mem__padding(arena);
+
+	if (!base || padding > arena->size - arena->used ||
+	    size > arena->size - arena->used - padding) {
+		mem__report_failure(arena, size, tag);
+		return NULL;
+	}
+
+	MemTagStats *stats = &arena->tags[tag];
+	stats->bytes += size;
+	stats->num_live++;
+	stats->num_pushed++;
+	if (stats->bytes > stats->peak_bytes) {
+		stats->peak_bytes = stats->bytes;
+	}
+
+	size_t push = arena->used + padding;
+	*mem__record(arena, push) = (ArenaRecord){
+		.start = arena->used,
+		.size  = size,
+		.prev  = arena->last_push,
+		.tag   = tag,
+	};
+	arena->last_push = push;
+
+	arena->used = push + size;
+	if (arena->used > arena->high_water) {
+		arena->high_water = arena->used;
+	}
+
+	return base + push;
+}
+
+ArenaMark mem_push_mark(Arena *arena) { return arena->used; }
 
-void *mem_load_file_to_temp_storage(Memory *memory, const char file_path[],
-				    size_t (*func)(const char[], void *,
-						   size_t),
-				    bool discard)
+/* Frees everything pushed since the mark was taken */
+void mem_pop_to_mark(Arena *arena, ArenaMark mark)
 {
-	unsigned char *load_location = (unsigned char *)memory->temp_storage +
-		memory->temp_next_load_offset;
-	ssize_t max_size = (ssize_t)memory->temp_storage_size -
-		(ssize_t)memory->temp_next_load_offset;
+	while (arena->last_push &&
+	       mem__record(arena, arena->last_push)->start >= mark) {
+		ArenaRecord *record = mem__record(arena, arena->last_push);
 
-	if (max_size <= 0)
+		arena->tags[record->tag].bytes -= record->size;
+		arena->tags[record->tag].num_live--;
+		arena->last_push = record->prev;
+	}
+
+	if (mark < arena->used) {
+		arena->used = mark;
+	}
+}
+
+void mem_reset_arena(Arena *arena) { mem_pop_to_mark(arena, 0); }
+
+/*
+ * Where a load into the arena's free space goes, with the room it has in
+ * max_size. Nothing may be pushed to the arena until the load is handed to
+ * mem_finish_load, so the load can run on another thread meanwhile. NULL if
+ * the arena is full.
+ */
+void *mem_begin_load(Arena *arena, size_t *max_size)
+{
+	unsigned char *base = (unsigned char *)mem_rel_get(&arena->base);
+	size_t padding      = mem__padding(arena);
+
+	if (!base || padding >= arena->size - arena->used)
 		return NULL;
 
-	size_t result =
-		func(file_path, (void *)load_location, (size_t)max_size);
+	*max_size = arena->size - arena->used - padding;
 
-	if (!result)
+	return base + arena->used + padding;
+}
+
+/*
+ * Accounts for loaded_size bytes written where mem_begin_load said, the way
+ * mem_load_file describes. Returns NULL if nothing was loaded.
+ */
+void *mem_finish_load(Arena *arena, void *load_location, size_t loaded_size,
+		      bool discard, MemTag tag)
+{
+	if (!load_location || !loaded_size)
 		return NULL;
 
-	if (!discard) {
-		memory->temp_next_load_offset = mem__get_next_aligned_offset(
-			memory->temp_next_load_offset, result, 32);
+	unsigned char *base = (unsigned char *)mem_rel_get(&arena->base);
+	size_t end = (size_t)((unsigned char *)load_location - base) +
+		loaded_size;
+
+	if (discard) {
+		MemTagStats *stats = &arena->tags[tag];
+
+		stats->num_pushed++;
+		if (stats->bytes + loaded_size > stats->peak_bytes) {
+			stats->peak_bytes = stats->bytes + loaded_size;
+		}
+		if (end > arena->high_water) {
+			arena->high_water = end;
+		}
+	} else if (!mem_arena_push(arena, loaded_size, tag)) {
+		return NULL;
 	}
 
-	return (void *)load_location;
+	return load_location;
 }
 
-void *mem_reserve_temp_storage(Memory *memory, size_t size_bytes)
+/*
+ * Loads a file into the arena's free space. Unless discard is set the file
+ * stays pushed; a discarded file is overwritten by the next push, so it
+ * only counts towards its tag's peak. The size func reported is written to
+ * loaded_size if it isn't NULL.
+ */
+void *mem_load_file(Arena *arena, const char file_path[],
+		    size_t (*func)(const char[], void *, size_t), bool discard,
+		    MemTag tag, size_t *loaded_size)
 {
-	ssize_t max_size = (ssize_t)memory->temp_storage_size -
-		(ssize_t)memory->temp_next_load_offset;
+	size_t max_size     = 0;
+	void *load_location = mem_begin_load(arena, &max_size);
 
-	if (max_size <= 0 || size_bytes > (size_t)max_size)
+	if (!load_location)
 		return NULL;
 
-	unsigned char *load_location = (unsigned char *)memory->temp_storage +
-		memory->temp_next_load_offset;
+	size_t result = func(file_path, load_location, max_size);
+
+	if (result && loaded_size) {
+		*loaded_size = result;
+	}
+
+	return mem_finish_load(arena, load_location, result, discard, tag);
+}
+
+void *mem_push_permanent(Memory *memory, size_t size, MemTag tag)
+{
+	return mem_arena_push(&memory->permanent_arena, size, tag);
+}
+
+void *mem_push_level(Memory *memory, size_t size, MemTag tag)
+{
+	return mem_arena_push(&memory->level_arena, size, tag);
+}
+
+/*
+ * The tag's stats in one arena. Arenas reach their peaks at different
+ * times, so peaks of different arenas don't add up to anything.
+ */
+MemTagStats mem_tag_stats(Arena *arena, MemTag tag)
+{
+	return arena->tags[tag];
+}
+
+/*
+ * Pushes room for capacity items of item_size bytes from the arena. Returns
+ * false, leaving the pool empty, if the arena is out of space.
+ */
+bool mem_create_pool(Pool *pool, Arena *arena, MemTag tag, size_t item_size,
+		     i32 capacity)
+{
+	size_t stride = (item_size + ARENA_ALIGNMENT - 1) &
+		~(size_t)(ARENA_ALIGNMENT - 1);
+
+	/* A free block has to hold its link */
+	if (stride < sizeof(i32)) {
+		stride = ARENA_ALIGNMENT;
+	}
+
+	*pool = (Pool){
+		.tag       = tag,
+		.item_size = item_size,
+		.stride    = stride,
+		.free_list = -1,
+	};
+
+	if (capacity <= 0)
+		return false;
+
+	void *base = mem_arena_push(arena, stride * (size_t)capacity, tag);
+	if (!base)
+		return false;
+
+	mem_rel_set(&pool->base, base);
+
+	pool->capacity = capacity;
+
+	return true;
+}
+
+/* Returns -1 for NULL or a pointer that isn't to one of the pool's blocks */
+i32 mem_pool_index(Pool *pool, void *item)
+{
+	unsigned char *block = (unsigned char *)item;
+	unsigned char *base  = (unsigned char *)mem_rel_get(&pool->base);
+
+	if (!block || block < base ||
+	    block >= base + (size_t)pool->capacity * pool->stride)
+		return -1;
+
+	size_t offset = (size_t)(block - base);
+	if (offset % pool->stride)
+		return -1;
+
+	return (i32)(offset / pool->stride);
+}
 
-	memory->temp_next_load_offset = mem__get_next_aligned_offset(
-		memory->temp_next_load_offset, size_bytes, 32);
+/* Returns NULL for an index outside the pool */
+void *mem_pool_at(Pool *pool, i32 index)
+{
+	if (index < 0 || index >= pool->capacity)
+		return NULL;
 
-	return (void *)load_location;
+	return mem__pool_block(pool, index);
 }
 
-static size_t mem__get_next_aligned_offset(size_t start_offset,
-					   size_t min_to_add, size_t alignment)
+/*
+ * Returns NULL if every block is in use. The first time that happens a
+ * report is printed; after that failures are only counted.
+ */
+void *mem_pool_alloc(Pool *pool)
 {
-	size_t min_new_offset = start_offset + min_to_add;
-	size_t remainder      = min_new_offset % alignment;
+	i32 index;
 
-	if (remainder) {
-		return min_new_offset + (alignment - remainder);
+	if (pool->free_list >= 0) {
+		index           = pool->free_list;
+		pool->free_list = *mem__pool_link(pool, index);
+		mem__check_poison(pool, index);
+	} else if (pool->num_fresh < pool->capacity) {
+		index = pool->num_fresh++;
 	} else {
-		return min_new_offset;
+		if (!pool->num_failures++) {
+			fprintf(stderr,
+				"memory: %s pool is out of its %d blocks\n",
+				mem_tag_names[pool->tag], pool->capacity);
+		}
+		return NULL;
+	}
+
+	if (++pool->num_used > pool->high_water) {
+		pool->high_water = pool->num_used;
+	}
+
+	return mem__pool_block(pool, index);
+}
+
+/* item must have come from this pool and not been freed since */
+void mem_pool_free(Pool *pool, void *item)
+{
+	i32 index = mem_pool_index(pool, item);
+	if (index < 0)
+		return;
+
+#ifdef DEBUG_POOLS
+	memset(item, POOL_POISON, pool->stride);
+#endif
+	*mem__pool_link(pool, index) = pool->free_list;
+	pool->free_list              = index;
+	pool->num_used--;
+}
+
+/*
+ * Writes each arena's size and high-water mark, what each tag has in it,
+ * how full the pools are and what the resident segments take. Segments,
+ * with their tiles and props, are held in Memory rather than an arena.
+ */
+void mem_write_usage(Memory *memory, FILE *out)
+{
+	Arena *arenas[] = {&memory->permanent_arena, &memory->level_arena,
+			   &memory->frame_arena};
+	Pool *paths = &memory->world_state.entities.paths;
+
+	for (i32 i = 0; i < 3; i++) {
+		Arena *arena = arenas[i];
+		if (!arena->size)
+			continue;
+
+		double percent =
+			100.0 * (double)arena->high_water / (double)arena->size;
+		fprintf(out,
+			"memory: %-10s %9zu of %9zu bytes at most (%.1f%%)\n",
+			arena->name, arena->high_water, arena->size, percent);
+
+		for (i32 tag = 0; tag < MEM_TAG_COUNT; tag++) {
+			MemTagStats *stats = &arena->tags[tag];
+			if (!stats->num_pushed)
+				continue;
+
+			fprintf(out,
+				"memory:   %-10s %9zu bytes in %3d "
+				"allocations, at most %9zu, %d pushed\n",
+				mem_tag_names[tag], stats->bytes,
+				stats->num_live, stats->peak_bytes,
+				stats->num_pushed);
+		}
+	}
+
+	if (paths->capacity) {
+		fprintf(out,
+			"memory: %-10s %9d of %9d blocks at most, %d "
+			"allocations failed\n",
+			mem_tag_names[paths->tag], paths->high_water,
+			paths->capacity, paths->num_failures);
+	}
+
+	fprintf(out, "memory: %-10s %9zu bytes in %d slots\n", "segments",
+		sizeof(memory->world_state.map_segments),
+		MAX_RESIDENT_SEGMENTS);
+}
+
+/* Writes mem_write_usage's report to a file. Returns false if it can't. */
+bool mem_dump_usage(Memory *memory, const char file_path[])
+{
+	FILE *file = fopen(file_path, "w");
+
+	if (!file) {
+		fprintf(stderr, "memory: can't write usage to %s\n", file_path);
+		return false;
+	}
+
+	mem_write_usage(memory, file);
+	fclose(file);
+
+	return true;
+}
+
+static void mem__carve_arena(Memory *memory, Arena *arena, const char *name,
+			     size_t *offset, size_t size)
+{
+	unsigned char *temp_storage =
+		(unsigned char *)mem_rel_get(&memory->temp_storage);
+
+	*arena = (Arena){.size = size};
+	snprintf(arena->name, sizeof(arena->name), "%s", name);
+	mem_rel_set(&arena->base, temp_storage + *offset);
+
+	*offset += size;
+}
+
+/*
+ * Bytes from the arena's top to where the next push starts: room for its
+ * record, then up to the next cache line
+ */
+static size_t mem__padding(Arena *arena)
+{
+	unsigned char *base = (unsigned char *)mem_rel_get(&arena->base);
+	uintptr_t record    = (uintptr_t)(base + arena->used);
+	uintptr_t push      = record + sizeof(ArenaRecord);
+
+	return sizeof(ArenaRecord) + (size_t)(-push & (ARENA_ALIGNMENT - 1));
+}
+
+static ArenaRecord *mem__record(Arena *arena, size_t push)
+{
+	unsigned char *base = (unsigned char *)mem_rel_get(&arena->base);
+
+	return (ArenaRecord *)(void *)(base + push - sizeof(ArenaRecord));
+}
+
+static void mem__report_failure(Arena *arena, size_t size, MemTag tag)
+{
+	const char *name = arena->name[0] ? arena->name : "unnamed";
+
+	fprintf(stderr,
+		"memory: %s arena can't fit %zu more bytes of %s "
+		"(%zu of %zu in use, at most %zu)\n",
+		name, size, mem_tag_names[tag], arena->used, arena->size,
+		arena->high_water);
+}
+
+static unsigned char *mem__pool_block(Pool *pool, i32 index)
+{
+	unsigned char *base = (unsigned char *)mem_rel_get(&pool->base);
+
+	return base + (size_t)index * pool->stride;
+}
+
+static i32 *mem__pool_link(Pool *pool, i32 index)
+{
+	return (i32 *)(void *)mem__pool_block(pool, index);
+}
+
+/* Everything past a free block's link should still be poison */
+static void mem__check_poison(Pool *pool, i32 index)
+{
+#ifdef DEBUG_POOLS
+	unsigned char *block = mem__pool_block(pool, index);
+
+	for (size_t i = sizeof(i32); i < pool->stride; i++) {
+		if (block[i] != POOL_POISON) {
+			fprintf(stderr,
+				"memory: %s pool block %d was written to "
+				"after being freed (byte %zu)\n",
+				mem_tag_names[pool->tag], index, i);
+			break;
+		}
 	}
+#else
+	(void)pool;
+	(void)index;
+#endif
 }
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: game.h, util.c
+ */
+
+/*
+ * Per-segment occupancy bitboards. Each row of a map segment is one u64, with
+ * bit x set if tile x of that row is occupied. Static collision and entities
+ * are kept in separate boards so entity moves can never clear a wall. Next to
+ * the entity board is a grid of the handles standing on each tile, so finding
+ * who is where never needs a search. Keeping entity FOVs up to date with
+ * these boards is left to the caller.
+ */
+
+static bool occ__in_bounds(i32 x, i32 y);
+
+void occ_set_collision(MapSegment *map_segment, i32 x, i32 y)
+{
+	if (!occ__in_bounds(x, y))
+		return;
+
+	map_segment->occupancy.collision[y] |= (u64)1 << x;
+}
+
+void occ_set_entity(MapSegment *map_segment, i32 x, i32 y,
+		    EntityHandle entity)
+{
+	if (!occ__in_bounds(x, y))
+		return;
+
+	map_segment->occupancy.entities[y] |= (u64)1 << x;
+	map_segment->occupancy.entity_at[y][x] = entity;
+}
+
+void occ_clear_entity(MapSegment *map_segment, i32 x, i32 y)
+{
+	if (!occ__in_bounds(x, y))
+		return;
+
+	map_segment->occupancy.entities[y] &= ~((u64)1 << x);
+	map_segment->occupancy.entity_at[y][x] = 0;
+}
+
+/* Returns 0 if there's no entity on the tile */
+EntityHandle occ_entity_at(MapSegment *map_segment, i32 x, i32 y)
+{
+	if (!occ__in_bounds(x, y))
+		return 0;
+
+	return map_segment->occupancy.entity_at[y][x];
+}
+
+/*
+ * Writes the handles of up to max_out entities within radius tiles of
+ * center (Chebyshev distance) to out, in row order, and returns how many
+ * were written. A radius of 1 gives an entity's neighbourhood, center
+ * included. Only rows of the square are visited, and within them only the
+ * occupied tiles.
+ *
+ * cursor is the tile (y * SCREEN_WIDTH_TILES + x) to carry on from, so a
+ * small buffer can be filled several times over: start it at 0 and call
+ * again until it reaches OCC_NUM_TILES.
+ */
+i32 occ_entities_in_radius(MapSegment *map_segment, Vec2 center, i32 radius,
+			   i32 *cursor, EntityHandle *out, i32 max_out)
+{
+	Occupancy *occupancy = &map_segment->occupancy;
+	i32 min_x = util_clamp(center.x - radius, 0, SCREEN_WIDTH_TILES - 1);
+	i32 max_x = util_clamp(center.x + radius, 0, SCREEN_WIDTH_TILES - 1);
+	i32 min_y = util_clamp(center.y - radius, 0, SCREEN_HEIGHT_TILES - 1);
+	i32 max_y = util_clamp(center.y + radius, 0, SCREEN_HEIGHT_TILES - 1);
+	u64 mask  = (((u64)1 << (max_x + 1)) - 1) & ~(((u64)1 << min_x) - 1);
+	i32 count = 0;
+	i32 first = *cursor;
+
+	if (radius < 0) {
+		*cursor = OCC_NUM_TILES;
+		return 0;
+	}
+
+	for (i32 y = min_y; y <= max_y; y++) {
+		u64 row = occupancy->entities[y] & mask;
+
+		if (y < first / SCREEN_WIDTH_TILES)
+			continue;
+		if (y == first / SCREEN_WIDTH_TILES)
+			row &= ~(((u64)1 << (first % SCREEN_WIDTH_TILES)) - 1);
+
+		while (row) {
+			i32 x = util_bit_scan_forward_u64(row);
+
+			if (count == max_out) {
+				*cursor = y * SCREEN_WIDTH_TILES + x;
+				return count;
+			}
+
+			out[count++] = occupancy->entity_at[y][x];
+			row &= row - 1;
+		}
+	}
+
+	*cursor = OCC_NUM_TILES;
+	return count;
+}
+
+/* Tiles outside the segment count as opaque */
+bool occ_is_opaque(MapSegment *map_segment, i32 x, i32 y)
+{
+	if (!occ__in_bounds(x, y))
+		return true;
+
+	u64 row = map_segment->occupancy.collision[y] |
+		map_segment->occupancy.entities[y];
+
+	return !!(row & ((u64)1 << x));
+}
+
+static bool occ__in_bounds(i32 x, i32 y)
+{
+	return x >= 0 && x < SCREEN_WIDTH_TILES && y >= 0 &&
+		y < SCREEN_HEIGHT_TILES;
+}
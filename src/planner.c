@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: <string.h>, game.h, util.c, occupancy.c
+ */
+
+/*
+ * Incremental path planner (Moving Target D* Lite). The search is rooted at
+ * the start (the chasing entity) and works towards the goal (the player), so
+ * g values are distances from the start. Planners keep their search state
+ * between turns and repair it for what changed:
+ *
+ * - the player moving is handled by the key modifier, with no repair at all
+ * - occupancy bits flipping updates just the flipped cells and neighbours
+ * - the entity moving re-roots the search at its new tile. The part of the
+ *   search tree that hangs off the new tile is kept as it is; only the
+ *   cells that reached it some other way are thrown out and searched
+ *   again. bench_udc ai reports repairs against fresh searches.
+ *
+ * g values are never shifted when the root moves. The new root keeps the
+ * cost it had, so every kept value is still right relative to it. They
+ * grow by a step each move, and the search starts over before they'd
+ * overflow.
+ *
+ * A search can also be cut off after a number of expansions and picked up
+ * again on a later call. Its state stays valid in between, so start, goal
+ * and occupancy changes made while it's suspended are repaired like any
+ * others.
+ *
+ * See Koenig & Likhachev, "D* Lite" (2002), and Sun, Yeoh & Koenig,
+ * "Moving Target D* Lite" (2010).
+ */
+
+#define PLAN_STEP_COST 10
+
+static void plan__reset(Planner *planner, i32 segment_index, Vec2 start,
+			Vec2 goal);
+static i32 plan__move_start(Planner *planner, Vec2 start);
+static void plan__sync_occupancy(Planner *planner, MapSegment *map_segment);
+static i32 plan__compute_shortest_path(Planner *planner,
+				       i32 max_expansions);
+static void plan__extract_path(Planner *planner);
+static void plan__update_cell(Planner *planner, i32 cell);
+static void plan__update_cell_and_neighbors(Planner *planner, i32 cell);
+static i32 plan__neighbors(i32 cell, i32 out[4]);
+static bool plan__is_blocked(Planner *planner, i32 cell);
+static i32 plan__cell(Vec2 tile);
+static i32 plan__heuristic(Vec2 a, i32 cell);
+static PlanKey plan__calculate_key(Planner *planner, i32 cell);
+static bool plan__key_less(PlanKey a, PlanKey b);
+static void plan__heap_push(Planner *planner, i32 cell, PlanKey key);
+static void plan__heap_remove(Planner *planner, i32 cell);
+static void plan__heap_sift_up(Planner *planner, i32 index);
+static void plan__heap_sift_down(Planner *planner, i32 index);
+static void plan__heap_swap(Planner *planner, i32 a, i32 b);
+
+/*
+ * Finds a planner for the given owner. Reuses the owner's planner if it still
+ * has one, otherwise takes a free planner, or the least recently used one if
+ * the pool is full. Planners used at or after busy_since belong to someone
+ * else this turn and are never taken. Returns the planner index, or -1 if
+ * nothing could be taken.
+ */
+i32 plan_acquire(Planner *planners, i32 num_planners, EntityHandle owner,
+		 u32 clock, u32 busy_since)
+{
+	i32 best = -1;
+
+	for (i32 i = 0; i < num_planners; i++) {
+		Planner *planner = &planners[i];
+
+		if (planner->owner == owner) {
+			best = i;
+			break;
+		}
+
+		if (planner->owner && planner->last_used >= busy_since)
+			continue;
+
+		if (best < 0 ||
+		    (planners[best].owner &&
+		     (!planner->owner ||
+		      planner->last_used < planners[best].last_used))) {
+			best = i;
+		}
+	}
+
+	if (best < 0)
+		return -1;
+
+	Planner *planner = &planners[best];
+	if (planner->owner != owner) {
+		planner->owner       = owner;
+		planner->initialized = false;
+	}
+	planner->last_used = clock;
+
+	return best;
+}
+
+void plan_release(Planner *planners, i32 num_planners, EntityHandle owner)
+{
+	for (i32 i = 0; i < num_planners; i++) {
+		if (planners[i].owner == owner) {
+			planners[i].owner       = 0;
+			planners[i].initialized = false;
+		}
+	}
+}
+
+/*
+ * Brings the planner's search up to date with the current start, goal and
+ * occupancy, expanding at most max_expansions cells. If the search finishes,
+ * search_done is set and the full path from start to goal is stored in
+ * planner->path. The path doesn't include the start tile, and it's empty if
+ * the goal can't be reached. If the search runs out of expansions the path
+ * from the last finished search is left alone. Returns how many cells were
+ * expanded, counting those thrown out because the start moved.
+ */
+i32 plan_update(Planner *planner, MapSegment *map_segment, Vec2 start,
+		Vec2 goal, i32 max_expansions)
+{
+	if (!planner->initialized ||
+	    planner->segment_index != map_segment->index) {
+		plan__reset(planner, map_segment->index, start, goal);
+	}
+
+	i32 work = 0;
+
+	if (start.x != planner->start.x || start.y != planner->start.y) {
+		work = plan__move_start(planner, start);
+		if (work < 0) {
+			plan__reset(planner, map_segment->index, start, goal);
+			work = 0;
+		}
+	}
+
+	plan__sync_occupancy(planner, map_segment);
+
+	if (goal.x != planner->goal.x || goal.y != planner->goal.y) {
+		i32 old_goal_cell = plan__cell(planner->goal);
+		i32 new_goal_cell = plan__cell(goal);
+
+		planner->key_modifier +=
+			plan__heuristic(planner->goal, new_goal_cell);
+		planner->goal = goal;
+
+		/* Goal tiles are never blocked, so both ends can change cost */
+		plan__update_cell_and_neighbors(planner, new_goal_cell);
+		plan__update_cell_and_neighbors(planner, old_goal_cell);
+	}
+
+	work += plan__compute_shortest_path(planner, max_expansions);
+
+	if (planner->search_done) {
+		plan__extract_path(planner);
+	}
+
+	return work;
+}
+
+static void plan__reset(Planner *planner, i32 segment_index, Vec2 start,
+			Vec2 goal)
+{
+	memset(planner->g, 0xFF, sizeof(planner->g));
+	memset(planner->rhs, 0xFF, sizeof(planner->rhs));
+	memset(planner->heap_index, 0xFF, sizeof(planner->heap_index));
+	memset(planner->parent, 0xFF, sizeof(planner->parent));
+	memset(planner->blocked, 0, sizeof(planner->blocked));
+
+	planner->segment_index = segment_index;
+	planner->start         = start;
+	planner->goal          = goal;
+	planner->key_modifier  = 0;
+	planner->heap_length   = 0;
+	planner->path_length   = 0;
+	planner->search_done   = false;
+	planner->initialized   = true;
+
+	i32 start_cell           = plan__cell(start);
+	planner->rhs[start_cell] = 0;
+	plan__heap_push(planner, start_cell,
+			plan__calculate_key(planner, start_cell));
+}
+
+/*
+ * Re-roots the search at the entity's new tile. That tile has to be in the
+ * old root's search tree, which it is when the entity walked its path.
+ * Everything under it stays. The rest of the old tree is emptied, and its
+ * cells are queued again from whatever neighbours they have left. Returns
+ * how many cells were thrown out, or -1 if the search has to start over
+ * instead.
+ */
+static i32 plan__move_start(Planner *planner, Vec2 start)
+{
+	i32 old_root = plan__cell(planner->start);
+	i32 new_root = plan__cell(start);
+	i32 cell     = new_root;
+	u16 deleted[PLAN_NUM_CELLS];
+	i32 num_deleted = 0;
+
+	if (planner->rhs[new_root] >=
+	    PLAN_INFINITY - PLAN_NUM_CELLS * PLAN_STEP_COST)
+		return -1;
+
+	for (i32 i = 0; i < PLAN_NUM_CELLS && cell >= 0 && cell != old_root;
+	     i++) {
+		cell = planner->parent[cell];
+	}
+
+	if (cell != old_root)
+		return -1;
+
+	planner->start            = start;
+	planner->parent[new_root] = -1;
+
+	/* deleted doubles as the stack for the walk down the old tree */
+	deleted[num_deleted++] = (u16)old_root;
+	for (i32 next = 0; next < num_deleted; next++) {
+		i32 neighbors[4];
+		i32 num_neighbors = plan__neighbors(deleted[next], neighbors);
+
+		for (i32 i = 0; i < num_neighbors; i++) {
+			if (planner->parent[neighbors[i]] == deleted[next]) {
+				deleted[num_deleted++] = (u16)neighbors[i];
+			}
+		}
+	}
+
+	for (i32 i = 0; i < num_deleted; i++) {
+		cell                  = deleted[i];
+		planner->g[cell]      = PLAN_INFINITY;
+		planner->rhs[cell]    = PLAN_INFINITY;
+		planner->parent[cell] = -1;
+
+		if (planner->heap_index[cell] >= 0) {
+			plan__heap_remove(planner, cell);
+		}
+	}
+
+	for (i32 i = 0; i < num_deleted; i++) {
+		plan__update_cell(planner, deleted[i]);
+	}
+
+	return num_deleted;
+}
+
+/*
+ * Diffs the occupancy the search was built against with the segment's
+ * current occupancy and repairs around every tile that changed. Which
+ * tiles block comes from the segment's entity grid: its bitboard for
+ * whether a tile is taken, and its handles to leave out the planner's own
+ * entity on the start. Anyone else found there still blocks.
+ */
+static void plan__sync_occupancy(Planner *planner, MapSegment *map_segment)
+{
+	Occupancy *occupancy = &map_segment->occupancy;
+	Vec2 start           = planner->start;
+	bool owner_on_start  =
+		occ_entity_at(map_segment, start.x, start.y) == planner->owner;
+
+	for (i32 y = 0; y < SCREEN_HEIGHT_TILES; y++) {
+		u64 current = occupancy->collision[y] | occupancy->entities[y];
+		if (y == start.y && owner_on_start) {
+			current &= ~((u64)1 << start.x);
+		}
+
+		u64 changed         = current ^ planner->blocked[y];
+		planner->blocked[y] = current;
+
+		while (changed) {
+			i32 x = util_bit_scan_forward_u64(changed);
+			changed &= changed - 1;
+
+			plan__update_cell_and_neighbors(
+				planner, y * SCREEN_WIDTH_TILES + x);
+		}
+	}
+}
+
+static i32 plan__compute_shortest_path(Planner *planner,
+				       i32 max_expansions)
+{
+	i32 goal_cell = plan__cell(planner->goal);
+	i32 expanded  = 0;
+
+	planner->search_done = true;
+
+	while (planner->heap_length > 0) {
+		PlanKey goal_key = plan__calculate_key(planner, goal_cell);
+		i32 cell         = planner->heap_cells[0];
+		PlanKey old_key  = planner->heap_keys[0];
+
+		if (!plan__key_less(old_key, goal_key) &&
+		    planner->rhs[goal_cell] == planner->g[goal_cell])
+			break;
+
+		if (expanded >= max_expansions) {
+			planner->search_done = false;
+			break;
+		}
+
+		PlanKey new_key = plan__calculate_key(planner, cell);
+
+		if (plan__key_less(old_key, new_key)) {
+			planner->heap_keys[0] = new_key;
+			plan__heap_sift_down(planner, 0);
+			continue;
+		}
+
+		expanded++;
+
+		if (planner->g[cell] > planner->rhs[cell]) {
+			planner->g[cell] = planner->rhs[cell];
+			plan__heap_remove(planner, cell);
+
+			i32 neighbors[4];
+			i32 num_neighbors = plan__neighbors(cell, neighbors);
+			for (i32 i = 0; i < num_neighbors; i++) {
+				plan__update_cell(planner, neighbors[i]);
+			}
+		} else {
+			planner->g[cell] = PLAN_INFINITY;
+			plan__update_cell_and_neighbors(planner, cell);
+		}
+	}
+
+	return expanded;
+}
+
+/*
+ * Follows the cheapest neighbor back from the goal until we reach the start,
+ * then turns the steps around. g has to drop every step, so a search that
+ * isn't settled along the way gives an empty path rather than a loop.
+ */
+static void plan__extract_path(Planner *planner)
+{
+	i32 cell       = plan__cell(planner->goal);
+	i32 start_cell = plan__cell(planner->start);
+
+	planner->path_length = 0;
+
+	if (planner->g[cell] == PLAN_INFINITY)
+		return;
+
+	while (cell != start_cell && planner->path_length < PLAN_NUM_CELLS) {
+		i32 neighbors[4];
+		i32 num_neighbors = plan__neighbors(cell, neighbors);
+		i32 best_cell     = -1;
+		i32 best_g        = planner->g[cell];
+
+		for (i32 i = 0; i < num_neighbors; i++) {
+			i32 neighbor = neighbors[i];
+			if (plan__is_blocked(planner, neighbor))
+				continue;
+
+			if (planner->g[neighbor] < best_g) {
+				best_g    = planner->g[neighbor];
+				best_cell = neighbor;
+			}
+		}
+
+		if (best_cell < 0) {
+			planner->path_length = 0;
+			return;
+		}
+
+		planner->path[planner->path_length++] = (u16)cell;
+		cell                                  = best_cell;
+	}
+
+	for (i32 i = 0; i < planner->path_length / 2; i++) {
+		i32 mirror            = planner->path_length - 1 - i;
+		u16 step              = planner->path[i];
+		planner->path[i]      = planner->path[mirror];
+		planner->path[mirror] = step;
+	}
+}
+
+/* The start keeps the cost it was given; see plan__move_start */
+static void plan__update_cell(Planner *planner, i32 cell)
+{
+	if (cell != plan__cell(planner->start)) {
+		i32 best        = PLAN_INFINITY;
+		i32 best_parent = -1;
+
+		if (!plan__is_blocked(planner, cell)) {
+			i32 neighbors[4];
+			i32 num_neighbors = plan__neighbors(cell, neighbors);
+
+			for (i32 i = 0; i < num_neighbors; i++) {
+				i32 neighbor = neighbors[i];
+				if (plan__is_blocked(planner, neighbor) ||
+				    planner->g[neighbor] == PLAN_INFINITY)
+					continue;
+
+				i32 cost = planner->g[neighbor] + PLAN_STEP_COST;
+				if (cost < best) {
+					best        = cost;
+					best_parent = neighbor;
+				}
+			}
+		}
+
+		planner->rhs[cell]    = (u16)best;
+		planner->parent[cell] = (i16)best_parent;
+	}
+
+	if (planner->heap_index[cell] >= 0) {
+		plan__heap_remove(planner, cell);
+	}
+
+	if (planner->g[cell] != planner->rhs[cell]) {
+		plan__heap_push(planner, cell, plan__calculate_key(planner, cell));
+	}
+}
+
+static void plan__update_cell_and_neighbors(Planner *planner, i32 cell)
+{
+	i32 neighbors[4];
+	i32 num_neighbors = plan__neighbors(cell, neighbors);
+
+	plan__update_cell(planner, cell);
+	for (i32 i = 0; i < num_neighbors; i++) {
+		plan__update_cell(planner, neighbors[i]);
+	}
+}
+
+static i32 plan__neighbors(i32 cell, i32 out[4])
+{
+	i32 x     = cell % SCREEN_WIDTH_TILES;
+	i32 y     = cell / SCREEN_WIDTH_TILES;
+	i32 count = 0;
+
+	if (y > 0)
+		out[count++] = cell - SCREEN_WIDTH_TILES;
+	if (x < SCREEN_WIDTH_TILES - 1)
+		out[count++] = cell + 1;
+	if (y < SCREEN_HEIGHT_TILES - 1)
+		out[count++] = cell + SCREEN_WIDTH_TILES;
+	if (x > 0)
+		out[count++] = cell - 1;
+
+	return count;
+}
+
+static bool plan__is_blocked(Planner *planner, i32 cell)
+{
+	i32 x = cell % SCREEN_WIDTH_TILES;
+	i32 y = cell / SCREEN_WIDTH_TILES;
+
+	if (x == planner->goal.x && y == planner->goal.y)
+		return false;
+
+	return !!(planner->blocked[y] & ((u64)1 << x));
+}
+
+static i32 plan__cell(Vec2 tile)
+{
+	return tile.y * SCREEN_WIDTH_TILES + tile.x;
+}
+
+static i32 plan__heuristic(Vec2 a, i32 cell)
+{
+	i32 x = cell % SCREEN_WIDTH_TILES;
+	i32 y = cell / SCREEN_WIDTH_TILES;
+
+	return PLAN_STEP_COST * (util_abs(a.x - x) + util_abs(a.y - y));
+}
+
+static PlanKey plan__calculate_key(Planner *planner, i32 cell)
+{
+	i32 g        = planner->g[cell];
+	i32 rhs      = planner->rhs[cell];
+	i32 min_cost = g < rhs ? g : rhs;
+
+	PlanKey key = {
+		.primary = min_cost + plan__heuristic(planner->goal, cell) +
+			planner->key_modifier,
+		.secondary = min_cost,
+	};
+
+	return key;
+}
+
+static bool plan__key_less(PlanKey a, PlanKey b)
+{
+	return a.primary < b.primary ||
+		(a.primary == b.primary && a.secondary < b.secondary);
+}
+
+static void plan__heap_push(Planner *planner, i32 cell, PlanKey key)
+{
+	i32 index                   = planner->heap_length++;
+	planner->heap_cells[index]  = (u16)cell;
+	planner->heap_keys[index]   = key;
+	planner->heap_index[cell]   = (i16)index;
+	plan__heap_sift_up(planner, index);
+}
+
+static void plan__heap_remove(Planner *planner, i32 cell)
+{
+	i32 index = planner->heap_index[cell];
+	i32 last  = --planner->heap_length;
+
+	planner->heap_index[cell] = -1;
+
+	if (index == last)
+		return;
+
+	planner->heap_cells[index] = planner->heap_cells[last];
+	planner->heap_keys[index]  = planner->heap_keys[last];
+	planner->heap_index[planner->heap_cells[index]] = (i16)index;
+
+	plan__heap_sift_up(planner, index);
+	plan__heap_sift_down(planner, planner->heap_index[planner->heap_cells[index]]);
+}
+
+static void plan__heap_sift_up(Planner *planner, i32 index)
+{
+	while (index > 0) {
+		i32 parent = (index - 1) / 2;
+		if (!plan__key_less(planner->heap_keys[index],
+				    planner->heap_keys[parent]))
+			break;
+
+		plan__heap_swap(planner, index, parent);
+		index = parent;
+	}
+}
+
+static void plan__heap_sift_down(Planner *planner, i32 index)
+{
+	for (;;) {
+		i32 left     = 2 * index + 1;
+		i32 right    = left + 1;
+		i32 smallest = index;
+
+		if (left < planner->heap_length &&
+		    plan__key_less(planner->heap_keys[left],
+				   planner->heap_keys[smallest]))
+			smallest = left;
+		if (right < planner->heap_length &&
+		    plan__key_less(planner->heap_keys[right],
+				   planner->heap_keys[smallest]))
+			smallest = right;
+
+		if (smallest == index)
+			break;
+
+		plan__heap_swap(planner, index, smallest);
+		index = smallest;
+	}
+}
+
+static void plan__heap_swap(Planner *planner, i32 a, i32 b)
+{
+	u16 cell_a  = planner->heap_cells[a];
+	PlanKey key = planner->heap_keys[a];
+
+	planner->heap_cells[a] = planner->heap_cells[b];
+	planner->heap_keys[a]  = planner->heap_keys[b];
+	planner->heap_cells[b] = cell_a;
+	planner->heap_keys[b]  = key;
+
+	planner->heap_index[planner->heap_cells[a]] = (i16)a;
+	planner->heap_index[planner->heap_cells[b]] = (i16)b;
+}
@@ -0,0 +1,287 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: <stdio.h>, game.h, memory.c, world.c
+ */
+
+/*
+ * Save states and input replays. The platform keeps Memory and temp storage
+ * in one region with nothing in it pointing at itself, so a save state is
+ * a SaveStateHeader followed by the region exactly as it was. A replay is a
+ * save state followed by one ReplayFrame per frame: the keys that frame got
+ * and a checksum of the simulation afterwards. The game only changes
+ * through its input, so playing the frames back from the saved state has
+ * to reproduce every checksum; the first frame that doesn't is reported as
+ * where the replay diverged. A save state is just a replay with no frames.
+ *
+ * Files only load into a build with the same Memory and region sizes.
+ * SAVE_STATE_VERSION needs bumping when the layout changes in ways the
+ * sizes don't show.
+ */
+
+#define SAVE_STATE_MAGIC 0x53434455 /* "UDCS" */
+#define SAVE_STATE_VERSION 1
+
+static u32 replay__hash(u32 hash, const void *data, size_t size);
+static bool replay__check_header(SaveStateHeader *header);
+
+bool replay_save_state(FILE *file, void *region, size_t region_size)
+{
+	SaveStateHeader header = {.magic       = SAVE_STATE_MAGIC,
+				  .version     = SAVE_STATE_VERSION,
+				  .memory_size = sizeof(Memory),
+				  .region_size = region_size};
+
+	return fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(region, 1, region_size, file) == region_size;
+}
+
+/*
+ * Reads a save state over the region. Everything is checked before the
+ * region is touched, so on failure the running game is left alone. The
+ * world's load handles are dropped, see world_forget_loads.
+ */
+bool replay_load_state(FILE *file, void *region, size_t region_size)
+{
+	SaveStateHeader header = {0};
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    !replay__check_header(&header) ||
+	    header.region_size != region_size)
+		return false;
+
+	long start = ftell(file);
+	fseek(file, 0, SEEK_END);
+	long end = ftell(file);
+	fseek(file, start, SEEK_SET);
+
+	if (start < 0 || end - start < (long)region_size)
+		return false;
+
+	if (fread(region, 1, region_size, file) != region_size)
+		return false;
+
+	world_forget_loads(&((Memory *)region)->world_state);
+
+	return true;
+}
+
+/* The size of region the save state or replay needs, 0 if it's unusable */
+size_t replay_region_size(const char file_path[])
+{
+	SaveStateHeader header = {0};
+	FILE *file             = fopen(file_path, "rb");
+
+	if (!file)
+		return 0;
+
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+		replay__check_header(&header);
+	fclose(file);
+
+	return ok ? (size_t)header.region_size : 0;
+}
+
+/*
+ * A hash of the simulation: the player, the world's clocks and transition,
+ * and every entity slot handed out. Rendering, arena bookkeeping and the
+ * frame arena's scratch are left out.
+ */
+u32 replay_checksum(Memory *memory)
+{
+	PlayerState *player_state = &memory->player_state;
+	WorldState *world_state   = &memory->world_state;
+	EntityPool *entities      = &world_state->entities;
+	size_t count              = (size_t)entities->num_slots;
+	u32 hash                  = 2166136261u;
+
+	i32 player[] = {
+		player_state->sprite_number, player_state->pixel_x,
+		player_state->pixel_y,       player_state->tile_x,
+		player_state->tile_y,        player_state->move_counter,
+		(i32)player_state->move_direction,
+	};
+	u32 world[] = {
+		(u32)world_state->current_map_segment,
+		(u32)world_state->next_map_segment,
+		(u32)world_state->trans_state,
+		(u32)world_state->transition_direction,
+		(u32)world_state->transition_counter,
+		world_state->frame_clock,
+		world_state->planner_clock,
+		(u32)entities->num_live,
+		(u32)entities->num_slots,
+		world_state->lod.pass,
+		(u32)world_state->lod.next_slot,
+	};
+
+	hash = replay__hash(hash, player, sizeof(player));
+	hash = replay__hash(hash, world, sizeof(world));
+	hash = replay__hash(hash, mem_rel_get(&entities->generation),
+			    count * sizeof(u16));
+	hash = replay__hash(hash, mem_rel_get(&entities->segment),
+			    count * sizeof(i32));
+	hash = replay__hash(hash, mem_rel_get(&entities->position),
+			    count * sizeof(Vec2));
+	hash = replay__hash(hash, mem_rel_get(&entities->ai_state),
+			    count * sizeof(AIStateIndex));
+	hash = replay__hash(hash, mem_rel_get(&entities->next_turn),
+			    count * sizeof(u32));
+	hash = replay__hash(hash, mem_rel_get(&entities->face_direction),
+			    count * sizeof(Direction));
+
+	return hash;
+}
+
+/* Saves the region as it is now, ahead of the frames to come */
+bool replay_start_recording(Replay *replay, const char file_path[],
+			    void *region, size_t region_size)
+{
+	*replay = (Replay){.diverged_frame = -1};
+
+	replay->file = fopen(file_path, "wb");
+	if (!replay->file) {
+		fprintf(stderr, "replay: can't write to %s\n", file_path);
+		return false;
+	}
+
+	if (!replay_save_state(replay->file, region, region_size)) {
+		fprintf(stderr, "replay: error writing %s\n", file_path);
+		fclose(replay->file);
+		replay->file = NULL;
+		return false;
+	}
+
+	replay->mode = REPLAY_RECORDING;
+
+	return true;
+}
+
+/* Puts the region back how it was when the replay was recorded */
+bool replay_start_playback(Replay *replay, const char file_path[],
+			   void *region, size_t region_size)
+{
+	*replay = (Replay){.diverged_frame = -1};
+
+	replay->file = fopen(file_path, "rb");
+	if (!replay->file) {
+		fprintf(stderr, "replay: can't open %s\n", file_path);
+		return false;
+	}
+
+	if (!replay_load_state(replay->file, region, region_size)) {
+		fprintf(stderr, "replay: %s isn't a replay for this build\n",
+			file_path);
+		fclose(replay->file);
+		replay->file = NULL;
+		return false;
+	}
+
+	replay->mode = REPLAY_PLAYING;
+
+	return true;
+}
+
+/*
+ * While playing, replaces input with the next recorded frame's. Returns
+ * false once the recording runs out.
+ */
+bool replay_begin_frame(Replay *replay, Input *input)
+{
+	ReplayFrame frame = {0};
+
+	if (replay->mode != REPLAY_PLAYING)
+		return true;
+
+	if (fread(&frame, sizeof(frame), 1, replay->file) != 1)
+		return false;
+
+	input->keys      = frame.keys;
+	replay->checksum = frame.checksum;
+
+	return true;
+}
+
+void replay_stop(Replay *replay)
+{
+	if (replay->mode == REPLAY_OFF)
+		return;
+
+	if (replay->mode == REPLAY_RECORDING) {
+		printf("replay: recorded %d frames\n", replay->num_frames);
+	} else if (replay->diverged_frame < 0) {
+		printf("replay: played %d frames, all matched\n",
+		       replay->num_frames);
+	} else {
+		printf("replay: played %d frames, diverged at frame %d\n",
+		       replay->num_frames, replay->diverged_frame);
+	}
+
+	fclose(replay->file);
+	replay->file = NULL;
+	replay->mode = REPLAY_OFF;
+}
+
+/*
+ * Call after each frame with the input it got. Records the frame, or checks
+ * it against the recording.
+ */
+void replay_end_frame(Replay *replay, Input *input, Memory *memory)
+{
+	if (replay->mode == REPLAY_OFF)
+		return;
+
+	u32 checksum = replay_checksum(memory);
+
+	if (replay->mode == REPLAY_RECORDING) {
+		ReplayFrame frame = {.keys = input->keys, .checksum = checksum};
+
+		if (fwrite(&frame, sizeof(frame), 1, replay->file) != 1) {
+			fprintf(stderr, "replay: error writing frame %d\n",
+				replay->num_frames);
+			replay_stop(replay);
+			return;
+		}
+	} else if (checksum != replay->checksum &&
+		   replay->diverged_frame < 0) {
+		replay->diverged_frame = replay->num_frames;
+		fprintf(stderr, "replay: diverged at frame %d\n",
+			replay->num_frames);
+	}
+
+	replay->num_frames++;
+}
+
+/* FNV-1a */
+static u32 replay__hash(u32 hash, const void *data, size_t size)
+{
+	const unsigned char *bytes = (const unsigned char *)data;
+
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+static bool replay__check_header(SaveStateHeader *header)
+{
+	return header->magic == SAVE_STATE_MAGIC &&
+		header->version == SAVE_STATE_VERSION &&
+		header->memory_size == sizeof(Memory);
+}
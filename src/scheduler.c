@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: game.h, memory.c
+ */
+
+/*
+ * Turn queues. Each map segment keeps a binary min-heap of the entity slots
+ * waiting to act, ordered by the frame they act on (the pool's next_turn)
+ * and then by slot. turn_index records where in its heap each entity sits,
+ * so an entity can be taken out or rescheduled without a search. Frame
+ * numbers wrap, so they're compared by their difference.
+ */
+
+static bool sched__before(EntityPool *pool, i32 a, i32 b);
+static void sched__place(EntityPool *pool, TurnQueue *queue, i32 index,
+			 i32 slot);
+static void sched__sift_up(EntityPool *pool, TurnQueue *queue, i32 index);
+static void sched__sift_down(EntityPool *pool, TurnQueue *queue, i32 index);
+
+/* Queues the entity to act on the given frame, moving it if it's queued */
+void sched_insert(EntityPool *pool, TurnQueue *queue, i32 slot, u32 frame)
+{
+	u32 *next_turn  = (u32 *)mem_rel_get(&pool->next_turn);
+	i32 *turn_index = (i32 *)mem_rel_get(&pool->turn_index);
+	i32 index       = turn_index[slot];
+
+	next_turn[slot] = frame;
+
+	if (index < 0) {
+		index = queue->count++;
+		sched__place(pool, queue, index, slot);
+		sched__sift_up(pool, queue, index);
+	} else {
+		sched__sift_up(pool, queue, index);
+		sched__sift_down(pool, queue, turn_index[slot]);
+	}
+}
+
+/* Does nothing if the entity isn't queued */
+void sched_remove(EntityPool *pool, TurnQueue *queue, i32 slot)
+{
+	i32 *turn_index = (i32 *)mem_rel_get(&pool->turn_index);
+	i32 index       = turn_index[slot];
+	if (index < 0)
+		return;
+
+	turn_index[slot] = -1;
+	queue->count--;
+	if (index == queue->count)
+		return;
+
+	/* Fill the hole with the last entry and let it find its place */
+	i32 last = queue->slots[queue->count];
+	sched__place(pool, queue, index, last);
+	sched__sift_up(pool, queue, index);
+	sched__sift_down(pool, queue, turn_index[last]);
+}
+
+/*
+ * Takes the earliest entity off the queue if it's due on or before frame.
+ * Returns its slot, or -1 if nobody is due.
+ */
+i32 sched_pop_due(EntityPool *pool, TurnQueue *queue, u32 frame)
+{
+	u32 *next_turn = (u32 *)mem_rel_get(&pool->next_turn);
+
+	if (queue->count == 0)
+		return -1;
+
+	i32 slot = queue->slots[0];
+	if ((i32)(next_turn[slot] - frame) > 0)
+		return -1;
+
+	sched_remove(pool, queue, slot);
+
+	return slot;
+}
+
+/* Empties the queue; the entities' next_turn is left as it was */
+void sched_clear(EntityPool *pool, TurnQueue *queue)
+{
+	i32 *turn_index = (i32 *)mem_rel_get(&pool->turn_index);
+
+	for (i32 i = 0; i < queue->count; i++) {
+		turn_index[queue->slots[i]] = -1;
+	}
+
+	queue->count = 0;
+}
+
+static bool sched__before(EntityPool *pool, i32 a, i32 b)
+{
+	u32 *next_turn = (u32 *)mem_rel_get(&pool->next_turn);
+	i32 difference = (i32)(next_turn[a] - next_turn[b]);
+
+	return difference < 0 || (difference == 0 && a < b);
+}
+
+static void sched__place(EntityPool *pool, TurnQueue *queue, i32 index,
+			 i32 slot)
+{
+	i32 *turn_index = (i32 *)mem_rel_get(&pool->turn_index);
+
+	queue->slots[index] = slot;
+	turn_index[slot]    = index;
+}
+
+static void sched__sift_up(EntityPool *pool, TurnQueue *queue, i32 index)
+{
+	i32 slot = queue->slots[index];
+
+	while (index > 0) {
+		i32 parent = (index - 1) / 2;
+		if (!sched__before(pool, slot, queue->slots[parent]))
+			break;
+
+		sched__place(pool, queue, index, queue->slots[parent]);
+		index = parent;
+	}
+
+	sched__place(pool, queue, index, slot);
+}
+
+static void sched__sift_down(EntityPool *pool, TurnQueue *queue, i32 index)
+{
+	i32 slot = queue->slots[index];
+
+	for (;;) {
+		i32 child = 2 * index + 1;
+		if (child >= queue->count)
+			break;
+
+		if (child + 1 < queue->count &&
+		    sched__before(pool, queue->slots[child + 1],
+				  queue->slots[child])) {
+			child++;
+		}
+
+		if (!sched__before(pool, queue->slots[child], slot))
+			break;
+
+		sched__place(pool, queue, index, queue->slots[child]);
+		index = child;
+	}
+
+	sched__place(pool, queue, index, slot);
+}
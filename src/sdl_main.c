@@ -21,8 +21,16 @@
 #include <string.h>
 #include <assert.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <SDL2/SDL.h>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 typedef int8_t i8;
 typedef int16_t i16;
 typedef int32_t i32;
@@ -35,18 +43,100 @@ typedef uint64_t u64;
 
 #include "game.h"
 #include "util.c"
-#include "hashmap.c"
-#include "ai.c"
 #include "memory.c"
+#include "bitmap.c"
+#include "occupancy.c"
+#include "fov.c"
+#include "planner.c"
+#include "scheduler.c"
+#include "entity.c"
+#include "ai.c"
 #include "tile_map.c"
+#include "world.c"
 #include "game.c"
-
+#include "replay.c"
+#include "asset_pack.c"
+
+#define MAX_WORKER_THREADS 8
+#define MAX_IO_THREADS 4
+#define DEFAULT_IO_THREADS 2
+#define MAX_ASSET_LOADS 32
+#define ASSET_PATH_LENGTH 256
+#define TEMP_STORAGE_SIZE (5 * 1024 * 1024)
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+#define MEMORY_USAGE_PATH "memory_usage.txt"
+#define MEMORY_USAGE_KEY SDLK_F9
+#define SAVE_STATE_PATH "save_state.bin"
+#define SAVE_STATE_KEY SDLK_F5
+#define LOAD_STATE_KEY SDLK_F8
+#define REPLAY_PATH "replay.bin"
+#define RECORD_REPLAY_KEY SDLK_F6
+#define PLAY_REPLAY_KEY SDLK_F7
+#define ASSET_PACK_PATH "resources/assets.pak"
+
+/* The game's memory and the mapping it lives in */
 typedef struct StorageState {
-	void *temp_storage;
-	size_t temp_storage_size;
+	Memory *memory;
+	void *region;
+	size_t region_size;
 	i32 err;
 } StorageState;
 
+/*
+ * Threads that help the main thread with platform_parallel_for. Each call
+ * posts work_ready once per worker and waits for work_done once per worker.
+ */
+typedef struct WorkerPool {
+	SDL_Thread *threads[MAX_WORKER_THREADS];
+	i32 num_threads;
+	SDL_sem *work_ready;
+	SDL_sem *work_done;
+	SDL_atomic_t next_index;
+	void (*func)(void *, i32);
+	void *data;
+	i32 count;
+	bool should_quit;
+} WorkerPool;
+
+static WorkerPool worker_pool;
+
+/* A load asked for with platform_request_asset_load */
+typedef struct AssetLoad {
+	char file_path[ASSET_PATH_LENGTH];
+	void *memory_location;
+	size_t max_size;
+	size_t (*func)(const char[], void *, size_t);
+	size_t loaded_size;
+	AssetLoadState state;
+	u32 generation; /* bumped when the slot is freed, see load_handle */
+	bool in_use;
+} AssetLoad;
+
+/*
+ * Threads that run asset loads in the background, oldest request first.
+ * mutex guards everything here. work_ready wakes the threads when a load is
+ * queued or it's time to quit, and work_done wakes anyone waiting when a
+ * load finishes. With no threads, loads run as they're asked for.
+ */
+typedef struct IOQueue {
+	SDL_Thread *threads[MAX_IO_THREADS];
+	i32 num_threads;
+	SDL_mutex *mutex;
+	SDL_cond *work_ready;
+	SDL_cond *work_done;
+	AssetLoad loads[MAX_ASSET_LOADS];
+	i32 queue[MAX_ASSET_LOADS]; /* indices into loads, a ring */
+	i32 queue_start;
+	i32 queue_length;
+	i32 num_running;
+	bool should_quit;
+} IOQueue;
+
+static IOQueue io_queue;
+
+/* Empty if there's no pack, in which case assets are loose files */
+static AssetView asset_pack;
+
 static const i32 image_buffer_size  = WIN_WIDTH * WIN_HEIGHT * 4;
 static const i32 image_buffer_pitch = WIN_WIDTH * 4;
 static const i32 target_sound_buffer_size =
@@ -55,7 +145,23 @@ static const i32 target_sound_buffer_size =
 static void handle_key_press(SDL_Keycode code, Input *input);
 static void handle_key_release(SDL_Keycode code, Input *input);
 static void handle_window_event(SDL_Event *event);
-static StorageState allocate_temp_storage();
+static StorageState allocate_game_memory();
+static void handle_debug_key(SDL_Keycode code, StorageState *storage,
+			     Replay *replay, ScreenState *screen_state);
+static i32 save_game_state(StorageState *storage, const char file_path[]);
+static i32 load_game_state(StorageState *storage, const char file_path[]);
+static void start_worker_pool(WorkerPool *pool);
+static void stop_worker_pool(WorkerPool *pool);
+static int worker_thread_main(void *data);
+static void run_parallel_jobs(WorkerPool *pool);
+static AssetView open_asset_pack(const char file_path[]);
+static void start_io_queue(IOQueue *queue);
+static void stop_io_queue(IOQueue *queue);
+static void finish_asset_loads(IOQueue *queue);
+static int io_thread_main(void *data);
+static void finish_asset_load(AssetLoad *load, size_t loaded_size);
+static i32 load_handle(IOQueue *queue, i32 index);
+static AssetLoad *find_asset_load(IOQueue *queue, i32 handle);
 
 int main()
 {
@@ -64,8 +170,9 @@ int main()
 	SDL_Texture *texture   = NULL;
 	int ret                = 0;
 
-	static Memory game_memory       = {0};
-	static ScreenState screen_state = {{0}, NULL, 0};
+	Memory *game_memory             = NULL;
+	StorageState storage            = {0};
+	static ScreenState screen_state = {{0}, NULL, 0, {0}};
 	i32 dt                          = 16;
 
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) != 0) {
@@ -109,27 +216,17 @@ int main()
 		goto cleanup;
 	}
 
-	StorageState storage = allocate_temp_storage();
+	storage = allocate_game_memory();
 
 	if (storage.err < 0) {
 		ret = 1;
 		goto cleanup;
 	}
 
-	game_memory.temp_storage          = storage.temp_storage;
-	game_memory.temp_storage_size     = storage.temp_storage_size;
-	game_memory.temp_next_load_offset = 0;
-	game_memory.is_initialized        = false;
+	game_memory = storage.memory;
+	asset_pack  = open_asset_pack(ASSET_PACK_PATH);
 
-	Sound sound             = {0};
-	sound.sound_buffer      = malloc(target_sound_buffer_size);
-	sound.sound_buffer_size = target_sound_buffer_size;
-
-	if (!sound.sound_buffer) {
-		SDL_Log("%s", "Failed to allocate sound buffer");
-		ret = 1;
-		goto cleanup;
-	}
+	Sound sound = {0};
 
 	SDL_AudioSpec audio_settings = {.freq     = SAMPLES_PER_SECOND,
 					.format   = AUDIO_S16SYS,
@@ -146,15 +243,34 @@ int main()
 
 	Input input       = {0};
 	FileStream stream = {0};
+	Replay replay     = {0};
 
 	/* Setup timespecs to enforce a set framerate in main loop */
 	i64 frametime = 16666667;
 	struct timespec start, end, sleeptime;
 	i64 delta;
 
+	start_worker_pool(&worker_pool);
+	start_io_queue(&io_queue);
+
 	/* MAIN LOOP */
 	bool should_quit = false;
-	game_initialize_memory(&game_memory, &screen_state, dt);
+	if (!game_initialize_memory(game_memory, &screen_state, dt)) {
+		SDL_Log("%s", "Failed to set up game memory");
+		ret = 1;
+		goto cleanup;
+	}
+
+	sound.sound_buffer = mem_push_permanent(
+		game_memory, (size_t)target_sound_buffer_size, MEM_TAG_AUDIO);
+	sound.sound_buffer_size = target_sound_buffer_size;
+
+	if (!sound.sound_buffer) {
+		SDL_Log("%s", "Failed to allocate sound buffer");
+		ret = 1;
+		goto cleanup;
+	}
+
 	clock_gettime(CLOCK_REALTIME, &start);
 	SDL_PauseAudio(0);
 	sound.playing = true;
@@ -172,6 +288,8 @@ int main()
 				handle_window_event(&event);
 				break;
 			case SDL_KEYDOWN: {
+				handle_debug_key(event.key.keysym.sym, &storage,
+						 &replay, &screen_state);
 				handle_key_press(event.key.keysym.sym, &input);
 				break;
 			}
@@ -194,7 +312,17 @@ int main()
 				sound.playing = false;
 		}
 
-		game_update_and_render(&game_memory, &input, &screen_state);
+		/* A replay being played stands in for the keyboard */
+		Input frame_input = input;
+		if (!replay_begin_frame(&replay, &frame_input)) {
+			replay_stop(&replay);
+			frame_input = input;
+		}
+
+		game_update_and_render(game_memory, &frame_input,
+				       &screen_state);
+
+		replay_end_frame(&replay, &frame_input, game_memory);
 
 		SDL_UpdateTexture(texture, 0, (void *)screen_state.image_buffer,
 				  image_buffer_pitch);
@@ -214,7 +342,13 @@ int main()
 		clock_gettime(CLOCK_REALTIME, &start);
 	}
 
+	replay_stop(&replay);
+	mem_dump_usage(game_memory, MEMORY_USAGE_PATH);
+
 cleanup:
+	stop_io_queue(&io_queue);
+	stop_worker_pool(&worker_pool);
+
 	if (texture) {
 		SDL_DestroyTexture(texture);
 	}
@@ -230,12 +364,12 @@ cleanup:
 		free(screen_state.image_buffer);
 	}
 
-	if (sound.sound_buffer) {
-		free(sound.sound_buffer);
+	if (storage.region) {
+		munmap(storage.region, storage.region_size);
 	}
 
-	if (storage.temp_storage) {
-		free(storage.temp_storage);
+	if (asset_pack.data) {
+		munmap((void *)asset_pack.data, asset_pack.size);
 	}
 
 	if (stream.fd) {
@@ -251,7 +385,12 @@ cleanup:
 i32 debug_platform_stream_audio(const char file_path[], FileStream *stream,
 				void *sound_buffer, i32 sound_buffer_size)
 {
-	if (!stream->fd) {
+	if (!stream->fd && !stream->view.data) {
+		stream->view     = pack_find(asset_pack, file_path);
+		stream->position = 0;
+	}
+
+	if (!stream->fd && !stream->view.data) {
 		stream->fd = fopen(file_path, "r");
 		printf("%s\n", "Opening file");
 		if (stream->fd == NULL) {
@@ -263,6 +402,32 @@ i32 debug_platform_stream_audio(const char file_path[], FileStream *stream,
 	i32 target_size    = sound_buffer_size;
 	i32 bytes_to_write = target_size - (i32)queued_size;
 
+	/*
+	 * Packed sounds are already samples, so they're queued from the pack.
+	 * The last chunk is queued however short it is, and the call after it
+	 * reports the end.
+	 */
+	if (bytes_to_write > 0 && stream->view.data) {
+		const unsigned char *samples =
+			(const unsigned char *)stream->view.data;
+		size_t remaining = stream->view.size - stream->position;
+
+		if (!remaining) {
+			stream->view = (AssetView){0};
+			return 0;
+		}
+
+		if (remaining < (size_t)bytes_to_write) {
+			bytes_to_write = (i32)remaining;
+		}
+
+		SDL_QueueAudio(1, samples + stream->position,
+			       (u32)bytes_to_write);
+		stream->position += (size_t)bytes_to_write;
+
+		return bytes_to_write;
+	}
+
 	if (bytes_to_write > 0) {
 		size_t result = fread(sound_buffer, 1, (size_t)bytes_to_write,
 				      stream->fd);
@@ -284,6 +449,16 @@ i32 debug_platform_stream_audio(const char file_path[], FileStream *stream,
 size_t debug_platform_load_asset(const char file_path[], void *memory_location,
 				 size_t max_size)
 {
+	AssetView packed = pack_find(asset_pack, file_path);
+
+	if (packed.data) {
+		if (packed.size > max_size)
+			return 0;
+
+		memcpy(memory_location, packed.data, packed.size);
+		return packed.size;
+	}
+
 	FILE *file = fopen(file_path, "rb");
 
 	if (file == NULL) {
@@ -292,27 +467,224 @@ size_t debug_platform_load_asset(const char file_path[], void *memory_location,
 	}
 
 	fseek(file, 0, SEEK_END);
-	size_t file_size = (size_t)ftell(file);
+	long file_size = ftell(file);
+	size_t result  = 0;
 
-	if (file_size > max_size) {
-		return 0;
+	if (file_size < 0 || (size_t)file_size > max_size) {
+		fprintf(stderr, "Asset doesn't fit.\n");
+		goto cleanup;
 	}
 
 	rewind(file);
 
-	size_t result = fread(memory_location, 1, file_size, file);
+	result = fread(memory_location, 1, (size_t)file_size, file);
 
-	if (result != file_size) {
-		fclose(file);
+	if (result != (size_t)file_size) {
 		fprintf(stderr, "Error reading asset\n");
-		return 0;
+		result = 0;
 	}
 
+cleanup:
 	fclose(file);
 
 	return result;
 }
 
+/*
+ * Maps the whole file read-only; see AssetView. Assets in the pack come
+ * straight from it instead.
+ */
+AssetView platform_map_asset(const char file_path[])
+{
+	AssetView view = pack_find(asset_pack, file_path);
+	struct stat file_stat;
+
+	if (view.data)
+		return view;
+
+	int fd = open(file_path, O_RDONLY);
+
+	if (fd < 0)
+		return view;
+
+	/* Empty files can't be mapped */
+	if (fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+		size_t size = (size_t)file_stat.st_size;
+		void *data  = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data != MAP_FAILED) {
+			view.data = data;
+			view.size = size;
+		}
+	}
+
+	/* The mapping stays good after the file is closed */
+	close(fd);
+
+	return view;
+}
+
+void platform_unmap_asset(AssetView view)
+{
+	if (view.data && !pack_contains(asset_pack, view)) {
+		munmap((void *)view.data, view.size);
+	}
+}
+
+/* Maps the pack for the whole run. A bad pack is left out */
+static AssetView open_asset_pack(const char file_path[])
+{
+	AssetView pack = platform_map_asset(file_path);
+
+	if (pack.data && !pack_check(pack, file_path)) {
+		platform_unmap_asset(pack);
+		pack = (AssetView){0};
+	}
+
+	return pack;
+}
+
+void platform_parallel_for(void (*func)(void *, i32), void *data, i32 count)
+{
+	WorkerPool *pool = &worker_pool;
+
+	/* Not worth waking anyone up for */
+	if (pool->num_threads == 0 || count < 2) {
+		for (i32 i = 0; i < count; i++) {
+			func(data, i);
+		}
+		return;
+	}
+
+	pool->func  = func;
+	pool->data  = data;
+	pool->count = count;
+	SDL_AtomicSet(&pool->next_index, 0);
+
+	for (i32 i = 0; i < pool->num_threads; i++) {
+		SDL_SemPost(pool->work_ready);
+	}
+
+	run_parallel_jobs(pool);
+
+	for (i32 i = 0; i < pool->num_threads; i++) {
+		SDL_SemWait(pool->work_done);
+	}
+}
+
+i32 platform_request_asset_load(const char file_path[], void *memory_location,
+				size_t max_size,
+				size_t (*func)(const char[], void *, size_t))
+{
+	IOQueue *queue = &io_queue;
+	i32 handle     = -1;
+
+	if (strlen(file_path) >= ASSET_PATH_LENGTH)
+		return -1;
+
+	if (!func) {
+		func = &debug_platform_load_asset;
+	}
+
+	if (queue->num_threads > 0) {
+		SDL_LockMutex(queue->mutex);
+	}
+
+	for (i32 i = 0; i < MAX_ASSET_LOADS; i++) {
+		AssetLoad *load = &queue->loads[i];
+
+		if (load->in_use)
+			continue;
+
+		strcpy(load->file_path, file_path);
+		load->memory_location = memory_location;
+		load->max_size        = max_size;
+		load->func            = func;
+		load->loaded_size     = 0;
+		load->state           = ASSET_LOAD_PENDING;
+		load->in_use          = true;
+		handle                = load_handle(queue, i);
+
+		if (queue->num_threads == 0) {
+			finish_asset_load(
+				load, func(file_path, memory_location, max_size));
+			break;
+		}
+
+		i32 end = (queue->queue_start + queue->queue_length) %
+			MAX_ASSET_LOADS;
+		queue->queue[end] = i;
+		queue->queue_length++;
+		SDL_CondSignal(queue->work_ready);
+		break;
+	}
+
+	if (queue->num_threads > 0) {
+		SDL_UnlockMutex(queue->mutex);
+	}
+
+	return handle;
+}
+
+AssetLoadState platform_poll_asset_load(i32 handle, size_t *loaded_size)
+{
+	IOQueue *queue       = &io_queue;
+	AssetLoadState state = ASSET_LOAD_FAILED;
+
+	if (queue->num_threads > 0) {
+		SDL_LockMutex(queue->mutex);
+	}
+
+	AssetLoad *load = find_asset_load(queue, handle);
+
+	if (load) {
+		state = load->state;
+	}
+
+	if (load && state != ASSET_LOAD_PENDING) {
+		if (loaded_size) {
+			*loaded_size = load->loaded_size;
+		}
+
+		load->in_use = false;
+		load->generation++;
+	}
+
+	if (queue->num_threads > 0) {
+		SDL_UnlockMutex(queue->mutex);
+	}
+
+	return state;
+}
+
+size_t platform_wait_asset_load(i32 handle)
+{
+	IOQueue *queue = &io_queue;
+	size_t result  = 0;
+
+	if (queue->num_threads > 0) {
+		SDL_LockMutex(queue->mutex);
+	}
+
+	AssetLoad *load = find_asset_load(queue, handle);
+
+	if (load) {
+		while (load->state == ASSET_LOAD_PENDING) {
+			SDL_CondWait(queue->work_done, queue->mutex);
+		}
+
+		result       = load->loaded_size;
+		load->in_use = false;
+		load->generation++;
+	}
+
+	if (queue->num_threads > 0) {
+		SDL_UnlockMutex(queue->mutex);
+	}
+
+	return result;
+}
+
 static void handle_window_event(SDL_Event *event)
 {
 	switch (event->window.event) {
@@ -325,25 +697,406 @@ static void handle_window_event(SDL_Event *event)
 	}
 }
 
-static StorageState allocate_temp_storage()
+/*
+ * Maps the game's memory as one region, the Memory struct first and temp
+ * storage taking the rest. The region is aligned to and sized in whole huge
+ * pages so transparent huge pages can back all of it, keeping TLB misses
+ * down when walking tile sets and maps. Setting UDC_PREFAULT touches every
+ * page up front so none faults in mid-game; UDC_MLOCK also locks the region
+ * into RAM, carrying on without if that's refused.
+ */
+static StorageState allocate_game_memory()
 {
-	StorageState storage           = {0};
-	size_t temp_storage_size_bytes = 5 * 1024 * 1024;
-	assert(temp_storage_size_bytes % 64 == 0);
-	storage.temp_storage = aligned_alloc(64, temp_storage_size_bytes);
-	if (!storage.temp_storage) {
-		fprintf(stderr, "Failed to temp storage for game\n");
+	StorageState storage = {0};
+	size_t memory_size   = (sizeof(Memory) + ARENA_ALIGNMENT - 1) &
+		~(size_t)(ARENA_ALIGNMENT - 1);
+	size_t region_size = (memory_size + TEMP_STORAGE_SIZE +
+			      HUGE_PAGE_SIZE - 1) &
+		~(HUGE_PAGE_SIZE - 1);
+
+	/* Over-reserve by a huge page, then trim to an aligned start */
+	size_t reserved_size = region_size + HUGE_PAGE_SIZE;
+	unsigned char *reserved =
+		mmap(NULL, reserved_size, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (reserved == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %zu bytes for game memory\n",
+			reserved_size);
 		storage.err = -1;
 
 		return storage;
 	}
 
-	storage.temp_storage_size = temp_storage_size_bytes;
-	memset(storage.temp_storage, 0, storage.temp_storage_size);
+	size_t head = (size_t)(-(uintptr_t)reserved & (HUGE_PAGE_SIZE - 1));
+	unsigned char *region = reserved + head;
+
+	if (head) {
+		munmap(reserved, head);
+	}
+	munmap(region + region_size, reserved_size - head - region_size);
+
+#ifdef MADV_HUGEPAGE
+	madvise(region, region_size, MADV_HUGEPAGE);
+#endif
+
+	if (getenv("UDC_PREFAULT")) {
+		memset(region, 0, region_size);
+	}
+
+	if (getenv("UDC_MLOCK") && mlock(region, region_size) != 0) {
+		fprintf(stderr, "Couldn't lock game memory into RAM\n");
+	}
+
+	/* A fresh mapping reads as zeroes, so Memory starts out cleared */
+	storage.memory = (Memory *)(void *)region;
+	mem_rel_set(&storage.memory->temp_storage, region + memory_size);
+	storage.memory->temp_storage_size = region_size - memory_size;
+	storage.region                    = region;
+	storage.region_size               = region_size;
 
 	return storage;
 }
 
+/*
+ * Keys for looking into and steering the game while it runs. Loading a
+ * state or starting a replay ends any replay already going.
+ */
+static void handle_debug_key(SDL_Keycode code, StorageState *storage,
+			     Replay *replay, ScreenState *screen_state)
+{
+	bool was_recording = replay->mode == REPLAY_RECORDING;
+	bool was_playing   = replay->mode == REPLAY_PLAYING;
+
+	switch (code) {
+	case MEMORY_USAGE_KEY:
+		mem_dump_usage(storage->memory, MEMORY_USAGE_PATH);
+		break;
+	case SAVE_STATE_KEY:
+		finish_asset_loads(&io_queue);
+		save_game_state(storage, SAVE_STATE_PATH);
+		break;
+	case LOAD_STATE_KEY:
+		replay_stop(replay);
+		finish_asset_loads(&io_queue);
+		if (load_game_state(storage, SAVE_STATE_PATH) == 0) {
+			game_redraw(storage->memory, screen_state);
+		}
+		break;
+	case RECORD_REPLAY_KEY:
+		replay_stop(replay);
+		finish_asset_loads(&io_queue);
+		if (!was_recording) {
+			replay_start_recording(replay, REPLAY_PATH,
+					       storage->region,
+					       storage->region_size);
+		}
+		break;
+	case PLAY_REPLAY_KEY:
+		replay_stop(replay);
+		finish_asset_loads(&io_queue);
+		if (!was_playing &&
+		    replay_start_playback(replay, REPLAY_PATH, storage->region,
+					  storage->region_size)) {
+			game_redraw(storage->memory, screen_state);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+static i32 save_game_state(StorageState *storage, const char file_path[])
+{
+	FILE *file = fopen(file_path, "wb");
+	i32 rc     = 0;
+
+	if (!file) {
+		fprintf(stderr, "Failed to open %s for saving\n", file_path);
+		return -1;
+	}
+
+	if (!replay_save_state(file, storage->region, storage->region_size)) {
+		fprintf(stderr, "Error writing save state\n");
+		rc = -1;
+	}
+
+	if (fclose(file) != 0) {
+		rc = -1;
+	}
+
+	return rc;
+}
+
+static i32 load_game_state(StorageState *storage, const char file_path[])
+{
+	FILE *file = fopen(file_path, "rb");
+	i32 rc     = 0;
+
+	if (!file) {
+		fprintf(stderr, "Failed to open %s for loading\n", file_path);
+		return -1;
+	}
+
+	if (!replay_load_state(file, storage->region, storage->region_size)) {
+		fprintf(stderr, "%s isn't a save state for this build\n",
+			file_path);
+		rc = -1;
+	}
+
+	fclose(file);
+
+	return rc;
+}
+
+/*
+ * One worker per spare core. UDC_WORKER_THREADS overrides the count, which is
+ * handy for checking that results don't depend on it.
+ */
+static void start_worker_pool(WorkerPool *pool)
+{
+	i32 num_threads = SDL_GetCPUCount() - 1;
+
+	char *override = getenv("UDC_WORKER_THREADS");
+	if (override) {
+		num_threads = atoi(override);
+	}
+
+	if (num_threads > MAX_WORKER_THREADS)
+		num_threads = MAX_WORKER_THREADS;
+
+	if (num_threads <= 0)
+		return;
+
+	pool->work_ready = SDL_CreateSemaphore(0);
+	pool->work_done  = SDL_CreateSemaphore(0);
+
+	if (!pool->work_ready || !pool->work_done) {
+		SDL_Log("Failed to create worker semaphores: %s",
+			SDL_GetError());
+		return;
+	}
+
+	for (i32 i = 0; i < num_threads; i++) {
+		SDL_Thread *thread =
+			SDL_CreateThread(worker_thread_main, "worker", pool);
+
+		if (!thread) {
+			SDL_Log("Failed to create worker thread: %s",
+				SDL_GetError());
+			break;
+		}
+
+		pool->threads[pool->num_threads++] = thread;
+	}
+}
+
+static void stop_worker_pool(WorkerPool *pool)
+{
+	pool->should_quit = true;
+
+	for (i32 i = 0; i < pool->num_threads; i++) {
+		SDL_SemPost(pool->work_ready);
+	}
+
+	for (i32 i = 0; i < pool->num_threads; i++) {
+		SDL_WaitThread(pool->threads[i], NULL);
+	}
+
+	pool->num_threads = 0;
+
+	if (pool->work_ready) {
+		SDL_DestroySemaphore(pool->work_ready);
+	}
+
+	if (pool->work_done) {
+		SDL_DestroySemaphore(pool->work_done);
+	}
+}
+
+static int worker_thread_main(void *data)
+{
+	WorkerPool *pool = (WorkerPool *)data;
+
+	for (;;) {
+		SDL_SemWait(pool->work_ready);
+
+		if (pool->should_quit)
+			break;
+
+		run_parallel_jobs(pool);
+		SDL_SemPost(pool->work_done);
+	}
+
+	return 0;
+}
+
+static void run_parallel_jobs(WorkerPool *pool)
+{
+	for (;;) {
+		i32 index = SDL_AtomicAdd(&pool->next_index, 1);
+		if (index >= pool->count)
+			break;
+
+		pool->func(pool->data, index);
+	}
+}
+
+/*
+ * Loads mostly wait on the disk, so a couple of threads are plenty.
+ * UDC_IO_THREADS overrides the count; 0 runs every load as it's asked for.
+ */
+static void start_io_queue(IOQueue *queue)
+{
+	i32 num_threads = DEFAULT_IO_THREADS;
+
+	char *override = getenv("UDC_IO_THREADS");
+	if (override) {
+		num_threads = atoi(override);
+	}
+
+	if (num_threads > MAX_IO_THREADS)
+		num_threads = MAX_IO_THREADS;
+
+	if (num_threads <= 0)
+		return;
+
+	queue->mutex      = SDL_CreateMutex();
+	queue->work_ready = SDL_CreateCond();
+	queue->work_done  = SDL_CreateCond();
+
+	if (!queue->mutex || !queue->work_ready || !queue->work_done) {
+		SDL_Log("Failed to create I/O queue locks: %s",
+			SDL_GetError());
+		return;
+	}
+
+	for (i32 i = 0; i < num_threads; i++) {
+		SDL_Thread *thread =
+			SDL_CreateThread(io_thread_main, "io", queue);
+
+		if (!thread) {
+			SDL_Log("Failed to create I/O thread: %s",
+				SDL_GetError());
+			break;
+		}
+
+		queue->threads[queue->num_threads++] = thread;
+	}
+}
+
+/* Loads still queued are dropped; ones already running finish first */
+static void stop_io_queue(IOQueue *queue)
+{
+	if (queue->num_threads > 0) {
+		SDL_LockMutex(queue->mutex);
+		queue->should_quit = true;
+		SDL_CondBroadcast(queue->work_ready);
+		SDL_UnlockMutex(queue->mutex);
+	}
+
+	for (i32 i = 0; i < queue->num_threads; i++) {
+		SDL_WaitThread(queue->threads[i], NULL);
+	}
+
+	queue->num_threads = 0;
+
+	if (queue->mutex) {
+		SDL_DestroyMutex(queue->mutex);
+	}
+
+	if (queue->work_ready) {
+		SDL_DestroyCond(queue->work_ready);
+	}
+
+	if (queue->work_done) {
+		SDL_DestroyCond(queue->work_done);
+	}
+}
+
+/*
+ * Waits until no load is queued or running, for when the game's memory is
+ * about to be copied or replaced. Finished loads keep their handles.
+ */
+static void finish_asset_loads(IOQueue *queue)
+{
+	if (queue->num_threads == 0)
+		return;
+
+	SDL_LockMutex(queue->mutex);
+
+	while (queue->queue_length > 0 || queue->num_running > 0) {
+		SDL_CondWait(queue->work_done, queue->mutex);
+	}
+
+	SDL_UnlockMutex(queue->mutex);
+}
+
+static int io_thread_main(void *data)
+{
+	IOQueue *queue = (IOQueue *)data;
+
+	SDL_LockMutex(queue->mutex);
+
+	for (;;) {
+		while (!queue->should_quit && queue->queue_length == 0) {
+			SDL_CondWait(queue->work_ready, queue->mutex);
+		}
+
+		if (queue->should_quit)
+			break;
+
+		i32 index       = queue->queue[queue->queue_start];
+		AssetLoad *load = &queue->loads[index];
+
+		queue->queue_start = (queue->queue_start + 1) % MAX_ASSET_LOADS;
+		queue->queue_length--;
+		queue->num_running++;
+
+		/* Nobody else touches a pending load, so it runs unlocked */
+		SDL_UnlockMutex(queue->mutex);
+		size_t result = load->func(load->file_path,
+					   load->memory_location,
+					   load->max_size);
+		SDL_LockMutex(queue->mutex);
+
+		finish_asset_load(load, result);
+		queue->num_running--;
+		SDL_CondBroadcast(queue->work_done);
+	}
+
+	SDL_UnlockMutex(queue->mutex);
+
+	return 0;
+}
+
+static void finish_asset_load(AssetLoad *load, size_t loaded_size)
+{
+	load->loaded_size = loaded_size;
+	load->state = loaded_size ? ASSET_LOAD_DONE : ASSET_LOAD_FAILED;
+}
+
+/*
+ * A handle is the slot in its low byte and the slot's generation above, so
+ * a handle that's already been freed doesn't match the slot's next load
+ */
+static i32 load_handle(IOQueue *queue, i32 index)
+{
+	return (i32)((queue->loads[index].generation & 0x7FFFFF) << 8) | index;
+}
+
+/* The load the handle is for, or NULL if it's been freed */
+static AssetLoad *find_asset_load(IOQueue *queue, i32 handle)
+{
+	i32 index = handle & 0xFF;
+
+	if (handle < 0 || index >= MAX_ASSET_LOADS ||
+	    !queue->loads[index].in_use || load_handle(queue, index) != handle)
+		return NULL;
+
+	return &queue->loads[index];
+}
+
 static void handle_key_press(SDL_Keycode code, Input *input)
 {
 	switch (code) {
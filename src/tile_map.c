@@ -16,12 +16,32 @@
  */
 
 /*
- * Dependendencies: game.h
+ * Dependendencies: <stdio.h>, <string.h>, game.h, util.c, memory.c,
+ * occupancy.c
+ */
+
+/*
+ * Tile maps come in two formats, told apart by their first four bytes.
+ *
+ * Binary maps start with a TileMapHeader, which points at a table of
+ * TileMapSegments, one per map segment in order. Each of those points at
+ * the segment's tiles and collision rows, stored exactly as MapSegment and
+ * Occupancy hold them so each is a single memcpy, and at a list of the
+ * tiles that have properties. A binary map is the world file segments are
+ * paged in from (see world.c): loading one only checks its header, and
+ * each segment is checked as it's loaded with tm_load_segment. Problems
+ * are reported on stderr.
+ *
+ * Anything else is read as the older text format: a line with the number
+ * of segments, then for each one a line "index-top-right-bottom-left",
+ * with _ for a missing connection, followed by one line per tile holding
+ * "background,foreground,properties,". The whole map is read at once into
+ * the slots of map_segments, so it can have no more segments than there
+ * are slots. tools/convert_tilemap.js writes both.
  */
 
 typedef struct TileMapParseState {
-	MapSegment *map_segment;
-	IntHashMap *tile_props;
+	MapSegment *map_segment; /* NULL until the first segment's line */
 	i32 file_index;
 	i32 map_segment_count;
 } TileMapParseState;
@@ -39,25 +59,52 @@ static TileMapParseState
 tm__read_map_segment_tiles(TileMapParseState parse_state,
 			   unsigned char *file_location);
 static void tm__set_map_segment_value(u32 x, u32 y, u32 layer, u32 tile_number,
-				      MapSegment *map_segment,
-				      IntHashMap *tile_props);
+				      MapSegment *map_segment);
+static i32 tm__open_world(const char file_path[], Memory *memory,
+			  const unsigned char *file, size_t file_size);
+static bool tm__check_header(const char file_path[], const unsigned char *file,
+			     size_t file_size);
+static bool tm__check_segment(const char file_path[],
+			      const unsigned char *file, size_t file_size,
+			      u32 id);
+static bool tm__in_file(size_t file_size, u32 offset, size_t length);
+static bool tm__is_connection(i32 connection, u32 num_segments);
 
 i32 tm_load_tile_map(const char file_path[], Memory *memory)
 {
-	void *temp_location = mem_load_file_to_temp_storage(
-		memory, file_path, &debug_platform_load_asset, true);
+	AssetView view = platform_map_asset(file_path);
+
+	if (!view.data)
+		return -1;
+
+	/* Binary maps are paged in later, see tm_load_segment */
+	if (view.size >= sizeof(TileMapHeader) &&
+	    ((const TileMapHeader *)view.data)->magic == TM_BINARY_MAGIC) {
+		i32 rc = tm__open_world(file_path, memory,
+					(const unsigned char *)view.data,
+					view.size);
+		platform_unmap_asset(view);
+		return rc;
+	}
+
+	platform_unmap_asset(view);
+
+	/* The text parser doesn't watch for the end, so it gets a copy */
+	void *temp_location = mem_load_file(&memory->level_arena, file_path,
+					    &debug_platform_load_asset, true,
+					    MEM_TAG_MAP, NULL);
 
 	if (!temp_location)
 		return -1;
 
 	TileMapParseState parse_state = {
-		.map_segment       = &memory->map_segments[0],
-		.tile_props        = &memory->world_state.tile_props,
+		.map_segment       = NULL,
 		.file_index        = 0,
 		.map_segment_count = 0,
 	};
 
 	parse_state = tm__get_map_segment_count(parse_state, temp_location);
+	memory->world_state.num_segments = parse_state.map_segment_count;
 
 	for (i32 i = 0; i < parse_state.map_segment_count; i++) {
 		parse_state = tm__read_map_segment_metadata(parse_state, memory,
@@ -69,6 +116,60 @@ i32 tm_load_tile_map(const char file_path[], Memory *memory)
 	return 0;
 }
 
+/*
+ * Loads one segment of a binary map into load_location, a MapSegment whose
+ * id says which. The connections, tiles, props and occupancy are filled
+ * in. Returns the size of a MapSegment, or 0 if the segment can't be
+ * loaded. This can run on an I/O thread, so it touches nothing but those
+ * fields and the file.
+ */
+size_t tm_load_segment(const char file_path[], void *load_location,
+		       size_t max_size)
+{
+	MapSegment *map_segment = (MapSegment *)load_location;
+	AssetView view          = platform_map_asset(file_path);
+	const unsigned char *file = (const unsigned char *)view.data;
+	size_t result             = 0;
+
+	if (!file || max_size < sizeof(MapSegment) ||
+	    !tm__check_header(file_path, file, view.size) ||
+	    map_segment->id < 0 ||
+	    !tm__check_segment(file_path, file, view.size,
+			       (u32)map_segment->id))
+		goto cleanup;
+
+	const TileMapHeader *header = (const TileMapHeader *)file;
+	const TileMapSegment *entry =
+		(const TileMapSegment *)(file + header->segments_offset) +
+		map_segment->id;
+	const TileMapProp *props =
+		(const TileMapProp *)(file + entry->props_offset);
+
+	map_segment->top_connection    = entry->top_connection;
+	map_segment->right_connection  = entry->right_connection;
+	map_segment->bottom_connection = entry->bottom_connection;
+	map_segment->left_connection   = entry->left_connection;
+
+	memcpy(map_segment->tiles, file + entry->tiles_offset,
+	       sizeof(map_segment->tiles));
+
+	memset(map_segment->props, 0, sizeof(map_segment->props));
+	for (u32 i = 0; i < entry->num_props; i++) {
+		map_segment->props[props[i].y][props[i].x] = props[i].value;
+	}
+
+	memset(&map_segment->occupancy, 0, sizeof(map_segment->occupancy));
+	memcpy(map_segment->occupancy.collision, file + entry->collision_offset,
+	       sizeof(map_segment->occupancy.collision));
+
+	result = sizeof(MapSegment);
+
+cleanup:
+	platform_unmap_asset(view);
+
+	return result;
+}
+
 static TileMapParseState
 tm__get_map_segment_count(TileMapParseState parse_state,
 			  unsigned char *file_location)
@@ -88,7 +189,7 @@ tm__get_map_segment_count(TileMapParseState parse_state,
 		}
 	}
 
-	if (count <= MAX_MAP_SEGMENTS) {
+	if (count <= MAX_RESIDENT_SEGMENTS) {
 		parse_state.map_segment_count = count;
 	}
 
@@ -99,31 +200,30 @@ static TileMapParseState
 tm__handle_map_segment_metadata(TileMapParseState parse_state, Memory *memory,
 				i32 state, i32 map_segment_index)
 {
-	if (map_segment_index >= MAX_MAP_SEGMENTS) {
+	if (map_segment_index >= MAX_RESIDENT_SEGMENTS ||
+	    (state > 0 && !parse_state.map_segment)) {
 		return parse_state;
 	}
 
+	/* The level was just reset, so segment i can have slot i */
 	switch (state) {
 	case 0:
 		parse_state.map_segment =
-			&memory->map_segments[map_segment_index];
-		parse_state.map_segment->index = map_segment_index;
+			&memory->world_state.map_segments[map_segment_index];
+		parse_state.map_segment->id    = map_segment_index;
+		parse_state.map_segment->state = SEGMENT_RESIDENT;
 		break;
 	case 1:
-		parse_state.map_segment->top_connection =
-			&memory->map_segments[map_segment_index];
+		parse_state.map_segment->top_connection = map_segment_index;
 		break;
 	case 2:
-		parse_state.map_segment->right_connection =
-			&memory->map_segments[map_segment_index];
+		parse_state.map_segment->right_connection = map_segment_index;
 		break;
 	case 3:
-		parse_state.map_segment->bottom_connection =
-			&memory->map_segments[map_segment_index];
+		parse_state.map_segment->bottom_connection = map_segment_index;
 		break;
 	case 4:
-		parse_state.map_segment->left_connection =
-			&memory->map_segments[map_segment_index];
+		parse_state.map_segment->left_connection = map_segment_index;
 		break;
 	}
 
@@ -173,6 +273,8 @@ static TileMapParseState
 tm__read_map_segment_tiles(TileMapParseState parse_state,
 			   unsigned char *file_location)
 {
+	MapSegment *map_segment = parse_state.map_segment;
+
 	for (u32 y = 0; y < SCREEN_HEIGHT_TILES; y++) {
 		for (u32 x = 0; x < SCREEN_WIDTH_TILES; x++) {
 			u32 tile_number = 0;
@@ -189,8 +291,7 @@ tm__read_map_segment_tiles(TileMapParseState parse_state,
 						tm__set_map_segment_value(
 							x, y, layer,
 							tile_number,
-							parse_state.map_segment,
-							parse_state.tile_props);
+							map_segment);
 					}
 					tile_number = 0;
 					layer += 1;
@@ -208,9 +309,11 @@ tm__read_map_segment_tiles(TileMapParseState parse_state,
 }
 
 static void tm__set_map_segment_value(u32 x, u32 y, u32 layer, u32 tile_number,
-				      MapSegment *map_segment,
-				      IntHashMap *tile_props)
+				      MapSegment *map_segment)
 {
+	if (!map_segment)
+		return;
+
 	switch (layer) {
 	case 0:
 		map_segment->tiles[y][x] = (tile_number & 0xFFFF) << 16;
@@ -222,13 +325,112 @@ static void tm__set_map_segment_value(u32 x, u32 y, u32 layer, u32 tile_number,
 		break;
 	}
 	case 2: {
-		i32 segment_index = map_segment->index;
-		u32 key = util_compactify_three_u32((u32)segment_index, x, y);
+		map_segment->props[y][x] = tile_number;
 
-		hash_insert_int(tile_props, key, (u32)tile_number);
+		if (tile_number & TPROP_HAS_COLLISION) {
+			occ_set_collision(map_segment, (i32)x, (i32)y);
+		}
 		break;
 	}
 	default:
 		break;
 	}
 }
+
+/* Checks the header and remembers the file to page segments in from */
+static i32 tm__open_world(const char file_path[], Memory *memory,
+			  const unsigned char *file, size_t file_size)
+{
+	const TileMapHeader *header = (const TileMapHeader *)file;
+	WorldState *world_state     = &memory->world_state;
+
+	if (!tm__check_header(file_path, file, file_size))
+		return -1;
+
+	if (strlen(file_path) >= sizeof(world_state->world_path)) {
+		fprintf(stderr, "tile map: %s has too long a path\n",
+			file_path);
+		return -1;
+	}
+
+	strcpy(world_state->world_path, file_path);
+	world_state->num_segments = (i32)header->num_segments;
+
+	return 0;
+}
+
+static bool tm__check_header(const char file_path[], const unsigned char *file,
+			     size_t file_size)
+{
+	const TileMapHeader *header = (const TileMapHeader *)file;
+
+	if (header->version != TM_BINARY_VERSION ||
+	    header->segment_width != SCREEN_WIDTH_TILES ||
+	    header->segment_height != SCREEN_HEIGHT_TILES ||
+	    header->num_segments > INT32_MAX ||
+	    !tm__in_file(file_size, header->segments_offset,
+			 header->num_segments * sizeof(TileMapSegment))) {
+		fprintf(stderr, "tile map: %s has an unsupported header\n",
+			file_path);
+		return false;
+	}
+
+	return true;
+}
+
+/* Checks segment id of a map whose header has been checked */
+static bool tm__check_segment(const char file_path[],
+			      const unsigned char *file, size_t file_size,
+			      u32 id)
+{
+	const TileMapHeader *header = (const TileMapHeader *)file;
+	size_t tiles_size           = sizeof(((MapSegment *)0)->tiles);
+	size_t collision_size       = sizeof(((Occupancy *)0)->collision);
+	u32 num_segments            = header->num_segments;
+
+	if (id >= num_segments) {
+		fprintf(stderr, "tile map: %s has no segment %u\n", file_path,
+			id);
+		return false;
+	}
+
+	const TileMapSegment *entry =
+		(const TileMapSegment *)(file + header->segments_offset) + id;
+	bool ok = true;
+
+	ok = ok && tm__in_file(file_size, entry->tiles_offset, tiles_size);
+	ok = ok && tm__in_file(file_size, entry->collision_offset,
+			       collision_size);
+	ok = ok && tm__in_file(file_size, entry->props_offset,
+			       entry->num_props * sizeof(TileMapProp));
+	ok = ok && tm__is_connection(entry->top_connection, num_segments);
+	ok = ok && tm__is_connection(entry->right_connection, num_segments);
+	ok = ok && tm__is_connection(entry->bottom_connection, num_segments);
+	ok = ok && tm__is_connection(entry->left_connection, num_segments);
+
+	const TileMapProp *props =
+		ok ? (const TileMapProp *)(file + entry->props_offset) : NULL;
+	for (u32 j = 0; ok && j < entry->num_props; j++) {
+		ok = props[j].x < SCREEN_WIDTH_TILES &&
+			props[j].y < SCREEN_HEIGHT_TILES;
+	}
+
+	if (!ok) {
+		fprintf(stderr, "tile map: segment %u of %s is bad\n", id,
+			file_path);
+	}
+
+	return ok;
+}
+
+/* Offsets also have to keep what they point at 8 byte aligned */
+static bool tm__in_file(size_t file_size, u32 offset, size_t length)
+{
+	return (offset & 7) == 0 && offset <= file_size &&
+		length <= file_size - offset;
+}
+
+static bool tm__is_connection(i32 connection, u32 num_segments)
+{
+	return connection >= -1 && connection < (i32)num_segments;
+}
@@ -23,26 +23,37 @@ i32 util_abs(i32 input) { return input < 0 ? input * -1 : input; }
 
 /*
  * Finds first set bit in an unsigned integer, starting from lowest bit.
- * Returns the index of the set bit.
+ * Returns the index of the set bit, or -1 if no bit is set.
  */
 i32 util_bit_scan_forward_u(u32 number)
 {
-	/* TODO: Use intrinsic for this */
-	bool found = false;
-	i32 index  = 0;
+	return number ? __builtin_ctz(number) : -1;
+}
 
-	while (!found) {
-		if (index > 31) {
-			index = -1;
-			break;
-		} else if (number & (1 << index)) {
-			found = true;
-		} else {
-			index++;
-		}
-	}
+/* Same as above for a u64, returns -1 if no bit is set */
+i32 util_bit_scan_forward_u64(u64 number)
+{
+	return number ? __builtin_ctzll(number) : -1;
+}
 
-	return index;
+i32 util_clamp(i32 input, i32 min, i32 max)
+{
+	return input < min ? min : input > max ? max : input;
+}
+
+/*
+ * Adapted from the Hash Function Prospector project:
+ * https://github.com/skeeto/hash-prospector
+ */
+u32 util_hash_u32(u32 input)
+{
+	u32 out = input;
+	out ^= out >> 16;
+	out *= 0x7feb352d;
+	out ^= out >> 15;
+	out *= 0x846ca68b;
+	out ^= out >> 16;
+	return out;
 }
 
 u32 util_compactify_three_u32(u32 a, u32 b, u32 c)
@@ -0,0 +1,336 @@
+/*
+ * Copyright (C) 2021 Alex Garrett
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Dependencies: <string.h>, game.h, entity.c, ai.c, tile_map.c
+ */
+
+/*
+ * The world is paged. Its segments live in the world file, a binary tile
+ * map, and only MAX_RESIDENT_SEGMENTS of them are held in map_segments at
+ * once. Segments are known by id, never by slot. When the player comes
+ * within WORLD_PREFETCH_DISTANCE tiles of an edge with a connection, the
+ * segment across it starts loading in the background. It's taken in
+ * WORLD_LOAD_FRAMES frames after it was asked for, or sooner if the screen
+ * scrolls onto it first, waiting for the load if it's still running.
+ *
+ * A segment that has to come in when no slot is free evicts the least
+ * recently used one. The current and next segments and the current one's
+ * neighbours are never evicted. An evicted segment's entities go into the
+ * entity pool's store and are spawned again when it's next taken in, see
+ * ai_store_segment. The store has room for as many entities as the pool,
+ * and a segment whose entities wouldn't fit is kept.
+ *
+ * How fast a load runs doesn't change what the simulation sees: which slot
+ * a segment gets depends only on the order segments are asked for, and
+ * when it's taken in, entities and all, only on when it was asked for.
+ * Replays stay in step however fast the disk is.
+ *
+ * A world read from a text map has no file to page from. Its segments all
+ * go into slots when the map is read and stay there.
+ */
+
+static MapSegment *world__find(WorldState *world_state, i32 id);
+static MapSegment *world__claim_slot(WorldState *world_state, i32 id);
+static void world__reset_slot(MapSegment *map_segment, i32 id);
+static bool world__is_pinned(WorldState *world_state, MapSegment *current,
+			     MapSegment *map_segment);
+static void world__finish_load(WorldState *world_state,
+			       MapSegment *map_segment);
+
+/* Empties every slot and forgets the world file */
+void world_clear(WorldState *world_state)
+{
+	MapSegment *map_segments = world_state->map_segments;
+
+	/* A load still running would write over the cleared slot */
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		if (map_segments[i].state == SEGMENT_LOADING) {
+			(void)platform_wait_asset_load(map_segments[i].load);
+		}
+	}
+
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		map_segments[i].index = i;
+		world__reset_slot(&map_segments[i], -1);
+	}
+
+	world_state->world_path[0] = 0;
+	world_state->num_segments  = 0;
+	world_state->world_clock   = 0;
+}
+
+/*
+ * Forgets the load handles in a save state that was just read. They belong
+ * to the run that wrote it and could match a different load in this one.
+ * Those segments are loaded again when they're due.
+ */
+void world_forget_loads(WorldState *world_state)
+{
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		world_state->map_segments[i].load = -1;
+	}
+}
+
+/*
+ * Takes a slot for a segment that's built in memory rather than loaded,
+ * emptied and marked resident. Returns NULL if every slot is pinned.
+ */
+MapSegment *world_place_segment(WorldState *world_state, i32 id)
+{
+	MapSegment *map_segment = world__claim_slot(world_state, id);
+
+	if (map_segment) {
+		map_segment->state = SEGMENT_RESIDENT;
+	}
+
+	return map_segment;
+}
+
+/* The segment if it's resident, NULL if it isn't or id is -1 */
+MapSegment *world_get_segment(WorldState *world_state, i32 id)
+{
+	MapSegment *map_segment = world__find(world_state, id);
+
+	if (!map_segment || map_segment->state != SEGMENT_RESIDENT)
+		return NULL;
+
+	return map_segment;
+}
+
+/*
+ * Starts the segment loading if it isn't resident or on its way. Returns
+ * its slot, which may still be loading, or NULL if it can't be loaded.
+ */
+MapSegment *world_request_segment(WorldState *world_state, i32 id)
+{
+	MapSegment *map_segment = world__find(world_state, id);
+
+	if (map_segment) {
+		map_segment->last_used = world_state->world_clock;
+		return map_segment;
+	}
+
+	if (id < 0 || id >= world_state->num_segments ||
+	    !world_state->world_path[0])
+		return NULL;
+
+	map_segment = world__claim_slot(world_state, id);
+
+	if (!map_segment)
+		return NULL;
+
+	/* If the queue is full, it's loaded when it's due instead */
+	map_segment->state    = SEGMENT_LOADING;
+	map_segment->load_due = world_state->world_clock + WORLD_LOAD_FRAMES;
+	map_segment->load =
+		platform_request_asset_load(world_state->world_path,
+					    map_segment, sizeof(MapSegment),
+					    &tm_load_segment);
+
+	return map_segment;
+}
+
+/* Like world_request_segment, but waits for the segment to be in */
+MapSegment *world_require_segment(WorldState *world_state, i32 id)
+{
+	MapSegment *map_segment = world_request_segment(world_state, id);
+
+	if (map_segment && map_segment->state == SEGMENT_LOADING) {
+		world__finish_load(world_state, map_segment);
+	}
+
+	return world_get_segment(world_state, id);
+}
+
+/*
+ * Called once a frame. Takes in loads that are due, marks the current
+ * segment used and starts loading any neighbour whose edge the player is
+ * near.
+ */
+void world_update(WorldState *world_state, Vec2 player_pos)
+{
+	MapSegment *map_segments = world_state->map_segments;
+
+	world_state->world_clock++;
+
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		MapSegment *map_segment = &map_segments[i];
+		u32 clock               = world_state->world_clock;
+
+		if (map_segment->state == SEGMENT_LOADING &&
+		    (i32)(clock - map_segment->load_due) >= 0) {
+			world__finish_load(world_state, map_segment);
+		}
+	}
+
+	MapSegment *current = world_get_segment(
+		world_state, world_state->current_map_segment);
+
+	if (!current)
+		return;
+
+	current->last_used = world_state->world_clock;
+
+	if (player_pos.y < WORLD_PREFETCH_DISTANCE) {
+		world_request_segment(world_state, current->top_connection);
+	}
+	if (player_pos.x >= SCREEN_WIDTH_TILES - WORLD_PREFETCH_DISTANCE) {
+		world_request_segment(world_state, current->right_connection);
+	}
+	if (player_pos.y >= SCREEN_HEIGHT_TILES - WORLD_PREFETCH_DISTANCE) {
+		world_request_segment(world_state, current->bottom_connection);
+	}
+	if (player_pos.x < WORLD_PREFETCH_DISTANCE) {
+		world_request_segment(world_state, current->left_connection);
+	}
+}
+
+/* The tile's TPROP_ flags, 0 if it's off the segment */
+u32 world_tile_props(MapSegment *map_segment, i32 x, i32 y)
+{
+	if (x < 0 || x >= SCREEN_WIDTH_TILES || y < 0 ||
+	    y >= SCREEN_HEIGHT_TILES)
+		return 0;
+
+	return map_segment->props[y][x];
+}
+
+/* The slot holding or loading the segment, NULL if there's none */
+static MapSegment *world__find(WorldState *world_state, i32 id)
+{
+	if (id < 0)
+		return NULL;
+
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		if (world_state->map_segments[i].id == id)
+			return &world_state->map_segments[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * An empty slot if there is one, otherwise the least recently used
+ * segment that isn't pinned, evicted. The slot comes back emptied and
+ * holding id.
+ */
+static MapSegment *world__claim_slot(WorldState *world_state, i32 id)
+{
+	MapSegment *map_segments = world_state->map_segments;
+	MapSegment *current =
+		world__find(world_state, world_state->current_map_segment);
+	MapSegment *victim = NULL;
+
+	for (i32 i = 0; i < MAX_RESIDENT_SEGMENTS; i++) {
+		MapSegment *map_segment = &map_segments[i];
+
+		if (map_segment->id < 0) {
+			victim = map_segment;
+			break;
+		}
+
+		if (!world__is_pinned(world_state, current, map_segment) &&
+		    (!victim || map_segment->last_used < victim->last_used)) {
+			victim = map_segment;
+		}
+	}
+
+	if (!victim) {
+		fprintf(stderr, "world: no slot free for segment %d\n", id);
+		return NULL;
+	}
+
+	if (victim->state == SEGMENT_LOADING) {
+		(void)platform_wait_asset_load(victim->load);
+	}
+
+	/* world__is_pinned made sure there's room */
+	(void)ai_store_segment(world_state, victim);
+
+	world__reset_slot(victim, id);
+	victim->last_used = world_state->world_clock;
+
+	/* Its entities were stored, so there's nothing else to let go of */
+	world_state->is_full_detail[victim->index] = false;
+
+	return victim;
+}
+
+/* Empties the slot, keeping its index, and gives it to id */
+static void world__reset_slot(MapSegment *map_segment, i32 id)
+{
+	i32 index = map_segment->index;
+
+	memset(map_segment, 0, sizeof(*map_segment));
+	map_segment->index             = index;
+	map_segment->id                = id;
+	map_segment->load              = -1;
+	map_segment->top_connection    = -1;
+	map_segment->right_connection  = -1;
+	map_segment->bottom_connection = -1;
+	map_segment->left_connection   = -1;
+	ent_clear_segment(&map_segment->entities);
+}
+
+static bool world__is_pinned(WorldState *world_state, MapSegment *current,
+			     MapSegment *map_segment)
+{
+	EntityPool *entities = &world_state->entities;
+	i32 id               = map_segment->id;
+
+	return id == world_state->current_map_segment ||
+		id == world_state->next_map_segment ||
+		map_segment->entities.num_entities >
+			entities->capacity - entities->num_stored ||
+		(current && (id == current->top_connection ||
+			     id == current->right_connection ||
+			     id == current->bottom_connection ||
+			     id == current->left_connection));
+}
+
+/*
+ * Waits for the segment's load and spawns its stored entities. A load that
+ * failed, or that never started because the queue was full or the handle
+ * was forgotten, is done here instead. A segment that still won't load
+ * gives its slot back, so the next request for it tries again. Its stored
+ * entities stay stored until then.
+ */
+static void world__finish_load(WorldState *world_state,
+			       MapSegment *map_segment)
+{
+	size_t loaded_size = 0;
+
+	if (map_segment->load >= 0) {
+		loaded_size = platform_wait_asset_load(map_segment->load);
+	}
+
+	map_segment->load = -1;
+
+	if (!loaded_size) {
+		loaded_size = tm_load_segment(world_state->world_path,
+					      map_segment, sizeof(MapSegment));
+	}
+
+	if (!loaded_size) {
+		world__reset_slot(map_segment, -1);
+		return;
+	}
+
+	map_segment->state = SEGMENT_RESIDENT;
+	ai_restore_segment(world_state, map_segment);
+}
@@ -5,6 +5,10 @@ if (!input || !output) {
 	console.log(
 		"USAGE: node convert_tilemap.js [input json] [output file]"
 	);
+	console.log(
+		"Output ending in .tmb is written in the binary format, " +
+		"anything else as text."
+	);
 
 	process.exit(1);
 }
@@ -179,48 +183,174 @@ for (let i = 0; i < objects.length; i++) {
 	}	
 }
 
-let out_string = [];
-
-out_string.push(num_tile_maps.toString() + "\n");
-
-/* Encoding tilemap data according to format recognized by game */
-for (let map_number = 0; map_number < num_tile_maps; map_number++) {
-	out_string.push(map_number.toString() 
-		+ "-" + connections[map_number] + "\n");
-
-	const { source_start_row, source_start_column } =
-		get_starting_rows_columns(map_number,
-			                  screen_width,
-			                  screen_height,
-					  basis);
-
-	for (let row = 0; row < screen_height; row++) {
-		for (let col = 0; col < screen_width; col++) {
-			const source_row = source_start_row + row;
-			const source_col = source_start_column + col;
-			const layer_1_val =  
-				layer_1[source_row * map_width + source_col];
-			const layer_2_val = 
-				layer_2[source_row * map_width + source_col];
-			const obj_val = 
-				obj_data[source_row * map_width + source_col];
-			out_string.push(
-				layer_1_val ? layer_1_val.toString() : "0"
-			);
-			out_string.push(",");
-			out_string.push(
-				layer_2_val ? layer_2_val.toString() : "0"
-			);
-			out_string.push(",");
-			out_string.push(
-				obj_val ? obj_val.toString() : "0"
-			);
-			out_string.push(",\n");
+/* Encodes the map in the text format, see tile_map.c */
+function build_text_map() {
+	let out_string = [];
+
+	out_string.push(num_tile_maps.toString() + "\n");
+
+	/* Encoding tilemap data according to format recognized by game */
+	for (let map_number = 0; map_number < num_tile_maps; map_number++) {
+		out_string.push(map_number.toString() 
+			+ "-" + connections[map_number] + "\n");
+
+		const { source_start_row, source_start_column } =
+			get_starting_rows_columns(map_number,
+				                  screen_width,
+				                  screen_height,
+						  basis);
+
+		for (let row = 0; row < screen_height; row++) {
+			for (let col = 0; col < screen_width; col++) {
+				const source_row = source_start_row + row;
+				const source_col = source_start_column + col;
+				const layer_1_val =  
+					layer_1[source_row * map_width + source_col];
+				const layer_2_val = 
+					layer_2[source_row * map_width + source_col];
+				const obj_val = 
+					obj_data[source_row * map_width + source_col];
+				out_string.push(
+					layer_1_val ? layer_1_val.toString() : "0"
+				);
+				out_string.push(",");
+				out_string.push(
+					layer_2_val ? layer_2_val.toString() : "0"
+				);
+				out_string.push(",");
+				out_string.push(
+					obj_val ? obj_val.toString() : "0"
+				);
+				out_string.push(",\n");
+			}
+		}
+	}
+
+	return out_string.join("");
+}
+
+/*
+ * Turns a segment's "top-right-bottom-left" connections into segment
+ * numbers, -1 where there's no connection
+ */
+function parse_connections(connections) {
+	return connections.split("-").map(x => {
+		return x === "_" ? -1 : parseInt(x, 10);
+	});
+}
+
+/*
+ * Encodes the map in the binary format, see tile_map.c and the TileMap
+ * structs in game.h. Every section is a multiple of 8 bytes long, which
+ * keeps all the offsets aligned.
+ */
+function build_binary_map() {
+	const header_size = 24;
+	const entry_size = 32;
+	const tiles_size = screen_width * screen_height * 4;
+	const collision_size = screen_height * 8;
+	const prop_size = 8;
+
+	let segments = [];
+	let offset = header_size + entry_size * num_tile_maps;
+
+	for (let map_number = 0; map_number < num_tile_maps; map_number++) {
+		const { source_start_row, source_start_column } =
+			get_starting_rows_columns(map_number,
+						  screen_width,
+						  screen_height,
+						  basis);
+
+		const tiles = Buffer.alloc(tiles_size);
+		const collision = Buffer.alloc(collision_size);
+		let props = [];
+
+		for (let row = 0; row < screen_height; row++) {
+			for (let col = 0; col < screen_width; col++) {
+				const index = (source_start_row + row)
+					* map_width + source_start_column + col;
+				const background = layer_1[index] || 0;
+				const foreground = layer_2[index] || 0;
+				const tile_props = obj_data[index] || 0;
+
+				tiles.writeUInt32LE(
+					(((background & 0xFFFF) << 16)
+						| foreground) >>> 0,
+					(row * screen_width + col) * 4
+				);
+
+				if (!tile_props)
+					continue;
+
+				props.push({ x: col, y: row, value: tile_props });
+
+				if (tile_props & 1) {
+					/* Rows are u64s, written as two halves */
+					const half = col < 32 ? 0 : 4;
+					const position = row * 8 + half;
+					const bits = collision.readUInt32LE(position);
+					collision.writeUInt32LE(
+						(bits | (1 << (col % 32))) >>> 0,
+						position
+					);
+				}
+			}
 		}
+
+		const prop_buffer = Buffer.alloc(props.length * prop_size);
+		props.forEach((prop, i) => {
+			prop_buffer.writeUInt16LE(prop.x, i * prop_size);
+			prop_buffer.writeUInt16LE(prop.y, i * prop_size + 2);
+			prop_buffer.writeUInt32LE(prop.value >>> 0,
+						  i * prop_size + 4);
+		});
+
+		const segment = {
+			connections: parse_connections(connections[map_number]),
+			tiles_offset: offset,
+			collision_offset: offset + tiles_size,
+			props_offset: offset + tiles_size + collision_size,
+			num_props: props.length,
+			data: [tiles, collision, prop_buffer],
+		};
+
+		offset += tiles_size + collision_size + prop_buffer.length;
+		segments.push(segment);
 	}
+
+	const header = Buffer.alloc(header_size);
+	header.writeUInt32LE(0x4D544455, 0); /* "UDTM" */
+	header.writeUInt32LE(1, 4);
+	header.writeUInt32LE(screen_width, 8);
+	header.writeUInt32LE(screen_height, 12);
+	header.writeUInt32LE(num_tile_maps, 16);
+	header.writeUInt32LE(header_size, 20);
+
+	const table = Buffer.alloc(entry_size * num_tile_maps);
+	segments.forEach((segment, i) => {
+		const base = i * entry_size;
+		segment.connections.forEach((connection, j) => {
+			table.writeInt32LE(connection, base + j * 4);
+		});
+		table.writeUInt32LE(segment.tiles_offset, base + 16);
+		table.writeUInt32LE(segment.collision_offset, base + 20);
+		table.writeUInt32LE(segment.props_offset, base + 24);
+		table.writeUInt32LE(segment.num_props, base + 28);
+	});
+
+	let parts = [header, table];
+	segments.forEach(segment => {
+		parts = parts.concat(segment.data);
+	});
+
+	return Buffer.concat(parts);
 }
 
-fs.writeFile(output, out_string.join(""), function(err) {
+const out_data = output.endsWith(".tmb") ?
+	build_binary_map() :
+	build_text_map();
+
+fs.writeFile(output, out_data, function(err) {
 	if (err)
 		console.log(err);
 });
@@ -0,0 +1,255 @@
+const input = process.argv[2];
+const output = process.argv[3];
+
+if (!input || !output) {
+	console.log(
+		"USAGE: node pack_assets.js [resources folder] [output file]"
+	);
+	console.log(
+		"Packs the .bmp, .wav, .tmb and .tm files in the folder, " +
+		"named resources/<path in folder>."
+	);
+
+	process.exit(1);
+}
+
+const fs = require('fs');
+const path = require('path');
+
+/* See the AssetPack structs in game.h and asset_pack.c */
+const pack_magic = 0x50414455; /* "UDAP" */
+const pack_version = 1;
+const alignment = 64;
+const name_length = 56;
+const header_size = 16;
+const entry_size = 64;
+
+/* See NativeBitmapHeader in game.h */
+const bitmap_magic = 0x4D424455; /* "UDBM" */
+const bitmap_version = 1;
+const bitmap_header_size = 16;
+
+/* What the platform layer asks SDL to play */
+const samples_per_second = 44100;
+const num_channels = 2;
+const bits_per_sample = 16;
+
+/* Every file under folder, as paths relative to it, in a stable order */
+function list_files(folder, prefix) {
+	let out = [];
+
+	fs.readdirSync(path.join(folder, prefix)).sort().forEach(name => {
+		const relative = prefix ? `${prefix}/${name}` : name;
+		const full = path.join(folder, relative);
+
+		if (fs.statSync(full).isDirectory())
+			out = out.concat(list_files(folder, relative));
+		else
+			out.push(relative);
+	});
+
+	return out;
+}
+
+/* Which byte of a pixel the mask covers, -1 for none */
+function mask_byte(file, mask) {
+	for (let i = 0; i < 4; i++) {
+		if (mask === (0xFF << (i * 8)) >>> 0)
+			return i;
+	}
+
+	if (mask)
+		throw new Error(`${file}: masks have to cover whole bytes`);
+
+	return -1;
+}
+
+/*
+ * Converts a BMP to the native layout: premultiplied ARGB, bottom row
+ * first. It takes the same BMPs as bitmap.c and rounds the same way, so
+ * packed and loose bitmaps come out the same.
+ */
+function convert_bitmap(file, data) {
+	const image_offset = data.readUInt32LE(10);
+	const info_size = data.readUInt32LE(14);
+	const width = data.readInt32LE(18);
+	const stored_height = data.readInt32LE(22);
+	const bits = data.readUInt16LE(28);
+	const compression = data.readUInt32LE(30);
+
+	const height = Math.abs(stored_height);
+	const bytes_per_pixel = bits / 8;
+	const stride = Math.floor((width * bits + 31) / 32) * 4;
+	const has_masks = compression === 3 || compression === 6;
+	const has_alpha = has_masks && (info_size >= 56 || compression === 6);
+
+	if ((!(bits === 24 && compression === 0) &&
+	     !(bits === 32 && (compression === 0 || has_masks))) ||
+	    width <= 0 || height === 0 ||
+	    image_offset + stride * (height - 1) + width * bytes_per_pixel >
+		    data.length)
+		throw new Error(`${file}: not a BMP the game can load`);
+
+	/* Bytes of red, green, blue and alpha within a pixel */
+	let channels = [2, 1, 0, -1];
+	if (has_masks) {
+		channels = [54, 58, 62, 66].map((position, i) => {
+			if (i === 3 && !has_alpha)
+				return -1;
+
+			return mask_byte(file, data.readUInt32LE(position));
+		});
+
+		if (channels.slice(0, 3).includes(-1))
+			throw new Error(`${file}: missing a colour mask`);
+	}
+
+	const out = Buffer.alloc(bitmap_header_size + width * height * 4);
+
+	out.writeUInt32LE(bitmap_magic, 0);
+	out.writeUInt32LE(bitmap_version, 4);
+	out.writeInt32LE(width, 8);
+	out.writeInt32LE(height, 12);
+
+	for (let y = 0; y < height; y++) {
+		const row = stored_height < 0 ? height - 1 - y : y;
+
+		for (let x = 0; x < width; x++) {
+			const pixel = image_offset + y * stride
+				+ x * bytes_per_pixel;
+			const [red_byte, green_byte, blue_byte, alpha_byte] =
+				channels;
+
+			const alpha = alpha_byte < 0 ?
+				255 : data[pixel + alpha_byte];
+			const premultiply = value => {
+				const t = value * alpha + 128;
+				return (t + (t >> 8)) >> 8;
+			};
+
+			const red = premultiply(data[pixel + red_byte]);
+			const green = premultiply(data[pixel + green_byte]);
+			const blue = premultiply(data[pixel + blue_byte]);
+
+			const argb = (alpha << 24) | (red << 16)
+				| (green << 8) | blue;
+			out.writeUInt32LE(argb >>> 0,
+				bitmap_header_size + (row * width + x) * 4);
+		}
+	}
+
+	return out;
+}
+
+/* Takes the samples out of a WAV, which has to be in the format played */
+function decode_wav(file, data) {
+	let format = null;
+	let offset = 12;
+
+	if (data.toString("ascii", 0, 4) !== "RIFF" ||
+	    data.toString("ascii", 8, 12) !== "WAVE")
+		throw new Error(`${file}: not a WAV file`);
+
+	while (offset + 8 <= data.length) {
+		const id = data.toString("ascii", offset, offset + 4);
+		const size = data.readUInt32LE(offset + 4);
+		const body = offset + 8;
+
+		if (id === "fmt ") {
+			format = {
+				encoding: data.readUInt16LE(body),
+				channels: data.readUInt16LE(body + 2),
+				rate: data.readUInt32LE(body + 4),
+				bits: data.readUInt16LE(body + 14),
+			};
+		} else if (id === "data") {
+			if (!format || format.encoding !== 1 ||
+			    format.channels !== num_channels ||
+			    format.rate !== samples_per_second ||
+			    format.bits !== bits_per_sample)
+				throw new Error(
+					`${file}: needs to be 16-bit stereo ` +
+					`${samples_per_second} Hz PCM`
+				);
+
+			return data.subarray(body, body + size);
+		}
+
+		/* Chunks are padded to an even length */
+		offset = body + size + (size & 1);
+	}
+
+	throw new Error(`${file}: has no samples`);
+}
+
+/* The data to pack for a file, or null if it isn't an asset */
+function build_asset(file, data) {
+	switch (path.extname(file)) {
+	case ".bmp":
+		return convert_bitmap(file, data);
+	case ".wav":
+		return decode_wav(file, data);
+	case ".tmb":
+	case ".tm":
+		return data;
+	default:
+		return null;
+	}
+}
+
+function align(offset) {
+	return Math.ceil(offset / alignment) * alignment;
+}
+
+let assets = [];
+
+list_files(input, "").forEach(file => {
+	const full = path.join(input, file);
+	if (path.resolve(full) === path.resolve(output))
+		return;
+
+	const name = `resources/${file}`;
+	const data = build_asset(file, fs.readFileSync(full));
+
+	if (!data || !data.length) {
+		console.log(`Skipping ${name}`);
+		return;
+	}
+
+	if (Buffer.byteLength(name) >= name_length)
+		throw new Error(`${name}: name is too long for the pack`);
+
+	assets.push({ name, data });
+});
+
+const entries_offset = align(header_size);
+let offset = align(entries_offset + entry_size * assets.length);
+
+const header = Buffer.alloc(entries_offset);
+header.writeUInt32LE(pack_magic, 0);
+header.writeUInt32LE(pack_version, 4);
+header.writeUInt32LE(assets.length, 8);
+header.writeUInt32LE(entries_offset, 12);
+
+const table = Buffer.alloc(offset - entries_offset);
+let parts = [header, table];
+
+assets.forEach((asset, i) => {
+	const base = i * entry_size;
+	const padded = align(asset.data.length);
+
+	table.write(asset.name, base, name_length - 1, "utf8");
+	table.writeUInt32LE(offset, base + name_length);
+	table.writeUInt32LE(asset.data.length, base + name_length + 4);
+
+	parts.push(asset.data);
+	parts.push(Buffer.alloc(padded - asset.data.length));
+	offset += padded;
+
+	console.log(`${asset.name}: ${asset.data.length} bytes`);
+});
+
+fs.writeFile(output, Buffer.concat(parts), function(err) {
+	if (err)
+		console.log(err);
+});